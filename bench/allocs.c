@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* counts the calls to the allocator of a program that it is preloaded
+ * into, as in
+ *
+ *   LD_PRELOAD=bench/allocs.so BENCH_ALLOCS=FILE program ...
+ *
+ * and writes the number of allocations and the bytes asked for to FILE
+ * when the program exits. the real functions are looked up on first use;
+ * what dlsym itself allocates before that comes from a static buffer. */
+
+typedef uint64_t u64;
+
+static void * (* g_malloc)(size_t);
+static void * (* g_calloc)(size_t, size_t);
+static void * (* g_realloc)(void *, size_t);
+static void (* g_free)(void *);
+
+static u64 g_allocs = 0;
+static u64 g_bytes = 0;
+
+static char g_bootstrap[1 << 12];
+static size_t g_bootstrap_used = 0;
+static int g_looking_up = 0;
+
+static void * _bootstrap_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t) 15;
+    if (g_bootstrap_used + size > sizeof(g_bootstrap))
+    {
+        return NULL;
+    }
+    void * p = g_bootstrap + g_bootstrap_used;
+    g_bootstrap_used += size;
+    return p;
+}
+
+static int _is_bootstrap(void * p)
+{
+    return (char *) p >= g_bootstrap && (char *) p < g_bootstrap + sizeof(g_bootstrap);
+}
+
+static void _look_up()
+{
+    g_looking_up = 1;
+    g_malloc = (void * (*)(size_t)) dlsym(RTLD_NEXT, "malloc");
+    g_calloc = (void * (*)(size_t, size_t)) dlsym(RTLD_NEXT, "calloc");
+    g_realloc = (void * (*)(void *, size_t)) dlsym(RTLD_NEXT, "realloc");
+    g_free = (void (*)(void *)) dlsym(RTLD_NEXT, "free");
+    g_looking_up = 0;
+}
+
+static void _count(size_t size)
+{
+    __atomic_fetch_add(&g_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_bytes, size, __ATOMIC_RELAXED);
+}
+
+void * malloc(size_t size)
+{
+    if (!g_malloc)
+    {
+        if (g_looking_up)
+        {
+            return _bootstrap_alloc(size);
+        }
+        _look_up();
+    }
+    _count(size);
+    return g_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+    if (!g_calloc)
+    {
+        if (g_looking_up)
+        {
+            /* the static buffer starts out zeroed and is never reused */
+            return _bootstrap_alloc(count * size);
+        }
+        _look_up();
+    }
+    _count(count * size);
+    return g_calloc(count, size);
+}
+
+void * realloc(void * p, size_t size)
+{
+    if (!g_realloc)
+    {
+        _look_up();
+    }
+    if (_is_bootstrap(p))
+    {
+        size_t const avail = g_bootstrap + sizeof(g_bootstrap) - (char *) p;
+        void * q = malloc(size);
+        if (q)
+        {
+            memcpy(q, p, size < avail ? size : avail);
+        }
+        return q;
+    }
+    _count(size);
+    return g_realloc(p, size);
+}
+
+void free(void * p)
+{
+    if (!p || _is_bootstrap(p))
+    {
+        return;
+    }
+    if (!g_free)
+    {
+        _look_up();
+    }
+    g_free(p);
+}
+
+__attribute__((destructor))
+static void _report()
+{
+    char const * path = getenv("BENCH_ALLOCS");
+    if (!path)
+    {
+        return;
+    }
+    u64 const allocs = g_allocs;
+    u64 const bytes = g_bytes;
+    FILE * f = fopen(path, "w");
+    if (f)
+    {
+        fprintf(f, "%llu %llu\n", (unsigned long long) allocs, (unsigned long long) bytes);
+        fclose(f);
+    }
+}
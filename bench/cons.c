@@ -0,0 +1,52 @@
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../lisp.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(char const * name, u64 count, double seconds)
+{
+    printf("%-8s %12" PRIu64 " ops %8.3f s %8.2f ns/op %8.2f Mops/s\n",
+           name, count, seconds, seconds * 1e9 / count, count / seconds * 1e-6);
+}
+
+/* usage: cons [COUNT]
+ *
+ * builds a single list of COUNT pairs, then walks it with car/cdr */
+int main(int argc, char ** argv)
+{
+    u64 const count = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000000;
+    Expr const atom = intern("x");
+
+    double start = now();
+    Expr list = nil;
+    for (u64 i = 0; i < count; i++)
+    {
+        list = cons(atom, list);
+    }
+    report("cons", count, now() - start);
+
+    start = now();
+    u64 length = 0;
+    for (Expr iter = list; iter; iter = cdr(iter))
+    {
+        length += car(iter) == atom;
+    }
+    report("walk", count, now() - start);
+
+    ASSERT(length == count);
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "../lisp.h"
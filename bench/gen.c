@@ -0,0 +1,258 @@
+#include "../lisp.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* usage: gen SHAPE-SIZE [SEED]
+ *
+ * writes about SIZE bytes of json documents of one shape to stdout, one
+ * document per line. SIZE is a count of bytes with an optional K, M or G
+ * after it, as in wide-16M. the same arguments always give the same
+ * output. the shapes are
+ *
+ *   deep     objects and arrays nested 512 deep
+ *   wide     arrays of 4096 small atoms
+ *   strings  long strings with some escapes and utf-8 in them
+ *   keys     objects whose keys are never the same twice
+ *   numbers  arrays of integers and doubles
+ *   small    many small records */
+
+static u64 g_state;
+
+static u64 next()
+{
+    g_state ^= g_state << 13;
+    g_state ^= g_state >> 7;
+    g_state ^= g_state << 17;
+    return g_state;
+}
+
+static u64 below(u64 limit)
+{
+    return next() % limit;
+}
+
+static u64 g_written = 0;
+
+static void put(char const * str)
+{
+    g_written += strlen(str);
+    fputs(str, stdout);
+}
+
+static void putf(char const * fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int const size = vprintf(fmt, args);
+    va_end(args);
+    ASSERT(size >= 0);
+    g_written += size;
+}
+
+static char const * const g_words[] =
+{
+    "alpha", "beta", "gamma", "delta", "pointer", "int", "char", "argc",
+    "simple-type", "const", "size_t", "struct", "return", "value", "name",
+    "type",
+};
+
+#define NUM_WORDS (sizeof(g_words) / sizeof(g_words[0]))
+
+static char const * word()
+{
+    return g_words[below(NUM_WORDS)];
+}
+
+static void gen_deep()
+{
+    int const depth = 512;
+    for (int i = 0; i < depth; i++)
+    {
+        put(i % 2 ? "[" : "{\"down\":");
+    }
+    putf("%" PRIu64, below(1000));
+    for (int i = depth - 1; i >= 0; i--)
+    {
+        put(i % 2 ? "]" : "}");
+    }
+}
+
+static void gen_wide()
+{
+    put("[");
+    for (int i = 0; i < 4096; i++)
+    {
+        if (i)
+        {
+            put(",");
+        }
+        switch (below(4))
+        {
+        case 0:
+            putf("%" PRIu64, below(100000));
+            break;
+        case 1:
+            putf("\"%s\"", word());
+            break;
+        case 2:
+            put(below(2) ? "true" : "false");
+            break;
+        default:
+            put("null");
+            break;
+        }
+    }
+    put("]");
+}
+
+static void gen_strings()
+{
+    /* mostly ascii text, with a few escapes and some multi-byte utf-8 */
+    static char const * const pieces[] =
+    {
+        "lorem ipsum dolor sit amet ", "consectetur adipiscing elit ",
+        "sed do eiusmod tempor ", "\\\"quoted\\\" ", "tab\\tand\\nnewline ",
+        "Gr\xc3\xbc\xc3\x9f" "e ", "\xe6\x9d\xb1\xe4\xba\xac ", "caf\\u00e9 ",
+    };
+    put("{\"id\":");
+    putf("%" PRIu64, below(1000000));
+    put(",\"text\":\"");
+    u64 const count = 32 + below(512);
+    for (u64 i = 0; i < count; i++)
+    {
+        u64 const r = below(16);
+        put(pieces[r < 13 ? r % 3 : r - 10]);
+    }
+    put("\"}");
+}
+
+static u64 g_next_key = 0;
+
+static void gen_keys()
+{
+    put("{");
+    for (int i = 0; i < 64; i++)
+    {
+        putf("%s\"key%" PRIu64 "\":%" PRIu64, i ? "," : "", g_next_key++, below(100));
+    }
+    put("}");
+}
+
+static void gen_numbers()
+{
+    put("[");
+    for (int i = 0; i < 256; i++)
+    {
+        if (i)
+        {
+            put(",");
+        }
+        switch (below(3))
+        {
+        case 0:
+            putf("%" PRId64, (int64_t) below(2000000000) - 1000000000);
+            break;
+        case 1:
+            putf("%.2f", (double) below(10000000) / 100);
+            break;
+        default:
+            putf("%.17g", (double) next() / 1e19);
+            break;
+        }
+    }
+    put("]");
+}
+
+static void gen_small()
+{
+    putf("{\"id\":%" PRIu64 ",\"name\":\"%s\",\"tags\":[\"%s\",\"%s\"],\"ok\":%s}",
+         below(1000000), word(), word(), word(), below(2) ? "true" : "false");
+}
+
+typedef struct
+{
+    char const * name;
+    void (* gen)();
+} Shape;
+
+static Shape const g_shapes[] =
+{
+    { "deep", gen_deep },
+    { "wide", gen_wide },
+    { "strings", gen_strings },
+    { "keys", gen_keys },
+    { "numbers", gen_numbers },
+    { "small", gen_small },
+};
+
+#define NUM_SHAPES (sizeof(g_shapes) / sizeof(g_shapes[0]))
+
+static u64 parse_size(char const * str)
+{
+    char * end;
+    u64 size = strtoull(str, &end, 10);
+    switch (*end)
+    {
+    case 'K':
+        size <<= 10;
+        end++;
+        break;
+    case 'M':
+        size <<= 20;
+        end++;
+        break;
+    case 'G':
+        size <<= 30;
+        end++;
+        break;
+    }
+    if (end == str || *end)
+    {
+        FAIL("bad size %s\n", str);
+    }
+    return size;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2)
+    {
+        FAIL("usage: gen SHAPE-SIZE [SEED]\n");
+    }
+    char const * dash = strrchr(argv[1], '-');
+    if (!dash)
+    {
+        FAIL("expected SHAPE-SIZE, got %s\n", argv[1]);
+    }
+    Shape const * shape = NULL;
+    for (size_t i = 0; i < NUM_SHAPES; i++)
+    {
+        if (strlen(g_shapes[i].name) == (size_t) (dash - argv[1]) &&
+            !memcmp(g_shapes[i].name, argv[1], dash - argv[1]))
+        {
+            shape = &g_shapes[i];
+        }
+    }
+    if (!shape)
+    {
+        FAIL("unknown shape %.*s\n", (int) (dash - argv[1]), argv[1]);
+    }
+    u64 const size = parse_size(dash + 1);
+    g_state = 0x9e3779b97f4a7c15ull ^ (argc > 2 ? strtoull(argv[2], NULL, 10) : 0);
+
+    static char buffer[1 << 16];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    while (g_written < size)
+    {
+        shape->gen();
+        put("\n");
+    }
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "../lisp.h"
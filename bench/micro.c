@@ -0,0 +1,332 @@
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../lisp.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* usage: micro [COUNT [REPS]] [NAME...]
+ *
+ * times the primitives of lisp.h on their own. each benchmark does COUNT
+ * operations (10000000 unless given) once to warm up and then REPS more
+ * times (15 unless given), rewinding the heap after each run, and reports
+ * the fastest and the median run in ns/op with the spread of the runs.
+ * given names, only the benchmarks with those names are run. */
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* results go here so that the loops are not optimized away */
+static volatile u64 g_sink;
+
+static Expr g_atom;
+static Expr g_list;
+
+static void setup_list(u64 count)
+{
+    g_list = nil;
+    for (u64 i = 0; i < count; i++)
+    {
+        g_list = cons(g_atom, g_list);
+    }
+}
+
+static void bench_make_pair(u64 count)
+{
+    Expr list = nil;
+    for (u64 i = 0; i < count; i++)
+    {
+        list = make_pair(g_atom, list);
+    }
+    g_sink = list;
+}
+
+static void bench_cons(u64 count)
+{
+    Expr list = nil;
+    for (u64 i = 0; i < count; i++)
+    {
+        list = cons(g_atom, list);
+    }
+    g_sink = list;
+}
+
+static void bench_cdr(u64 count)
+{
+    u64 length = 0;
+    for (Expr iter = g_list; iter; iter = cdr(iter))
+    {
+        length++;
+    }
+    ASSERT(length == count);
+    g_sink = length;
+}
+
+static void bench_car_cdr(u64 count)
+{
+    u64 length = 0;
+    for (Expr iter = g_list; iter; iter = cdr(iter))
+    {
+        length += car(iter) == g_atom;
+    }
+    ASSERT(length == count);
+    g_sink = length;
+}
+
+#define NUM_HIT_NAMES 4096
+
+static char g_hit_names[NUM_HIT_NAMES][16];
+
+static void setup_intern_hit(u64 count)
+{
+    for (int i = 0; i < NUM_HIT_NAMES; i++)
+    {
+        snprintf(g_hit_names[i], sizeof(g_hit_names[i]), "name%d", i);
+        intern(g_hit_names[i]);
+    }
+}
+
+static void bench_intern_hit(u64 count)
+{
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++)
+    {
+        sum += intern(g_hit_names[i & (NUM_HIT_NAMES - 1)]);
+    }
+    g_sink = sum;
+}
+
+/* every name is new; it is made by counting up in place, which costs a
+ * few cycles in the loop */
+static void bench_intern_miss(u64 count)
+{
+    char name[] = "miss0000000000";
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++)
+    {
+        sum += intern(name);
+        char * digit = name + sizeof(name) - 2;
+        while (*digit == '9')
+        {
+            *digit-- = '0';
+        }
+        (*digit)++;
+    }
+    g_sink = sum;
+}
+
+static void bench_string_short(u64 count)
+{
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++)
+    {
+        sum += make_string("pointer");
+    }
+    g_sink = sum;
+}
+
+static void bench_string_long(u64 count)
+{
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++)
+    {
+        sum += make_string("a string too long to be kept in the expression");
+    }
+    g_sink = sum;
+}
+
+static void bench_make_expr(u64 count)
+{
+    /* each expression depends on the one before it */
+    Expr exp = nil;
+    for (u64 i = 0; i < count; i++)
+    {
+        exp = make_expr(i & 7, expr_data(exp) + i);
+    }
+    g_sink = exp;
+}
+
+#define NUM_TAG_EXPRS 4096
+
+static Expr g_tag_exprs[NUM_TAG_EXPRS];
+
+static void setup_expr_type(u64 count)
+{
+    for (int i = 0; i < NUM_TAG_EXPRS; i++)
+    {
+        switch ((i * 7) % 6)
+        {
+        case 0:
+            g_tag_exprs[i] = nil;
+            break;
+        case 1:
+            g_tag_exprs[i] = intern("symbol");
+            break;
+        case 2:
+            g_tag_exprs[i] = intern(":keyword");
+            break;
+        case 3:
+            g_tag_exprs[i] = cons(nil, nil);
+            break;
+        case 4:
+            g_tag_exprs[i] = make_string(i & 1 ? "short" : "a string in the arena");
+            break;
+        default:
+            g_tag_exprs[i] = make_integer(i);
+            break;
+        }
+    }
+}
+
+/* the dispatch that every walk over a value does */
+static void bench_expr_type(u64 count)
+{
+    u64 sum = 0;
+    for (u64 i = 0; i < count; i++)
+    {
+        Expr const exp = g_tag_exprs[i & (NUM_TAG_EXPRS - 1)];
+        switch (expr_type(exp))
+        {
+        case TYPE_NIL:
+            sum += 1;
+            break;
+        case TYPE_SYMBOL:
+        case TYPE_KEYWORD:
+            sum += expr_data(exp);
+            break;
+        case TYPE_PAIR:
+            sum += 3;
+            break;
+        case TYPE_STRING:
+        case TYPE_SHORT_STRING:
+            sum += 5;
+            break;
+        default:
+            sum += 7;
+            break;
+        }
+    }
+    g_sink = sum;
+}
+
+typedef struct
+{
+    char const * name;
+    void (* setup)(u64 count);
+    void (* run)(u64 count);
+} Bench;
+
+static Bench const g_benches[] =
+{
+    { "make_pair", NULL, bench_make_pair },
+    { "cons", NULL, bench_cons },
+    { "cdr", setup_list, bench_cdr },
+    { "car+cdr", setup_list, bench_car_cdr },
+    { "intern-hit", setup_intern_hit, bench_intern_hit },
+    { "intern-miss", NULL, bench_intern_miss },
+    { "string-short", NULL, bench_string_short },
+    { "string-long", NULL, bench_string_long },
+    { "make_expr", NULL, bench_make_expr },
+    { "expr_type", setup_expr_type, bench_expr_type },
+};
+
+#define NUM_BENCHES (sizeof(g_benches) / sizeof(g_benches[0]))
+
+static int compare_doubles(void const * a, void const * b)
+{
+    double const x = *(double const *) a;
+    double const y = *(double const *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_bench(Bench const * bench, u64 count, int reps)
+{
+    HeapMark mark = heap_mark();
+    if (bench->setup)
+    {
+        bench->setup(count);
+    }
+    /* what the setup made stays for every run */
+    HeapMark const kept = heap_mark();
+
+    double * ns = (double *) malloc(reps * sizeof(double));
+    ASSERT(ns);
+    for (int rep = -1; rep < reps; rep++)
+    {
+        double const start = now();
+        bench->run(count);
+        double const seconds = now() - start;
+        heap_rewind(kept);
+        if (rep >= 0)
+        {
+            ns[rep] = seconds * 1e9 / count;
+        }
+    }
+    heap_rewind(mark);
+
+    double mean = 0;
+    for (int i = 0; i < reps; i++)
+    {
+        mean += ns[i];
+    }
+    mean /= reps;
+    double var = 0;
+    for (int i = 0; i < reps; i++)
+    {
+        var += (ns[i] - mean) * (ns[i] - mean);
+    }
+    double const stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+
+    qsort(ns, reps, sizeof(double), compare_doubles);
+    double const median = reps % 2 ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2;
+    printf("%-12s %8.2f ns/op min %8.2f median %8.2f mean %6.2f%% stddev %8.2f Mops/s\n",
+           bench->name, ns[0], median, mean, 100 * stddev / mean, 1e3 / ns[0]);
+    fflush(stdout);
+    free(ns);
+}
+
+int main(int argc, char ** argv)
+{
+    int i = 1;
+    u64 count = 10000000;
+    int reps = 15;
+    if (i < argc && argv[i][0] >= '0' && argv[i][0] <= '9')
+    {
+        count = strtoull(argv[i++], NULL, 10);
+        if (i < argc && argv[i][0] >= '0' && argv[i][0] <= '9')
+        {
+            reps = atoi(argv[i++]);
+        }
+    }
+    if (count < 1 || reps < 1)
+    {
+        FAIL("bad count or number of runs\n");
+    }
+    g_atom = intern("x");
+
+    printf("%" PRIu64 " ops, %d runs\n", count, reps);
+    for (size_t b = 0; b < NUM_BENCHES; b++)
+    {
+        bool wanted = i == argc;
+        for (int j = i; j < argc; j++)
+        {
+            wanted |= !strcmp(argv[j], g_benches[b].name);
+        }
+        if (wanted)
+        {
+            run_bench(&g_benches[b], count, reps);
+        }
+    }
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "../lisp.h"
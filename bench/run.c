@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "../lisp.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* usage: run [-n RUNS] CORPUS.json...
+ *
+ * converts each corpus with json2sexp and its CORPUS.sexp with sexp2json,
+ * building trees and with --stream, and writes one line of json for each
+ * of them to stdout:
+ *
+ *   {"corpus":"small-16M","tool":"json2sexp","mode":"tree","bytes":...,
+ *    "docs":...,"seconds":...,"mb_per_s":...,"docs_per_s":...,
+ *    "max_rss_kb":...,"allocs":...,"alloc_bytes":...}
+ *
+ * the time is the best of RUNS runs (3 unless given), and the peak
+ * resident set and the allocations are those of that run. a document is a
+ * line of the corpus. the allocations are counted by bench/allocs.so,
+ * which is preloaded into the tools. */
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct
+{
+    double seconds;
+    long max_rss_kb;
+    u64 allocs;
+    u64 alloc_bytes;
+} Sample;
+
+static char g_allocs_lib[PATH_MAX];
+static char g_allocs_out[PATH_MAX];
+
+static void run_once(char * const * argv, char const * input, Sample * sample)
+{
+    unlink(g_allocs_out);
+    double const start = now();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        FAIL("fork failed\n");
+    }
+    if (pid == 0)
+    {
+        int in = open(input, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0)
+        {
+            _exit(127);
+        }
+        setenv("LD_PRELOAD", g_allocs_lib, 1);
+        setenv("BENCH_ALLOCS", g_allocs_out, 1);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0)
+    {
+        FAIL("wait failed\n");
+    }
+    sample->seconds = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        FAIL("%s failed on %s\n", argv[0], input);
+    }
+    sample->max_rss_kb = usage.ru_maxrss;
+
+    unsigned long long allocs = 0;
+    unsigned long long bytes = 0;
+    FILE * f = fopen(g_allocs_out, "r");
+    if (f)
+    {
+        if (fscanf(f, "%llu %llu", &allocs, &bytes) != 2)
+        {
+            allocs = bytes = 0;
+        }
+        fclose(f);
+    }
+    sample->allocs = allocs;
+    sample->alloc_bytes = bytes;
+}
+
+static u64 count_lines(char const * path)
+{
+    FILE * f = fopen(path, "r");
+    if (!f)
+    {
+        FAIL("cannot open %s\n", path);
+    }
+    static char buffer[1 << 16];
+    u64 lines = 0;
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            lines += buffer[i] == '\n';
+        }
+    }
+    fclose(f);
+    return lines;
+}
+
+static u64 file_size(char const * path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        FAIL("cannot stat %s\n", path);
+    }
+    return st.st_size;
+}
+
+static void bench(char const * corpus, char const * tool, char const * mode, char const * input,
+                  u64 docs, int runs)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "./%s", tool);
+    char * argv[] = { path, !strcmp(mode, "stream") ? "--stream" : NULL, NULL };
+
+    Sample best = { 0, 0, 0, 0 };
+    for (int i = 0; i < runs; i++)
+    {
+        Sample sample;
+        run_once(argv, input, &sample);
+        if (i == 0 || sample.seconds < best.seconds)
+        {
+            best = sample;
+        }
+    }
+    u64 const bytes = file_size(input);
+    printf("{\"corpus\":\"%s\",\"tool\":\"%s\",\"mode\":\"%s\",\"bytes\":%" PRIu64 ",\"docs\":%" PRIu64
+           ",\"seconds\":%.6f,\"mb_per_s\":%.2f,\"docs_per_s\":%.0f,\"max_rss_kb\":%ld"
+           ",\"allocs\":%" PRIu64 ",\"alloc_bytes\":%" PRIu64 "}\n",
+           corpus, tool, mode, bytes, docs, best.seconds, bytes / best.seconds / (1 << 20),
+           docs / best.seconds, best.max_rss_kb, best.allocs, best.alloc_bytes);
+    fflush(stdout);
+}
+
+int main(int argc, char ** argv)
+{
+    int runs = 3;
+    int i = 1;
+    if (i + 1 < argc && !strcmp(argv[i], "-n"))
+    {
+        runs = atoi(argv[i + 1]);
+        i += 2;
+    }
+    if (runs < 1)
+    {
+        FAIL("bad number of runs\n");
+    }
+    if (!realpath("bench/allocs.so", g_allocs_lib))
+    {
+        FAIL("cannot find bench/allocs.so\n");
+    }
+    snprintf(g_allocs_out, sizeof(g_allocs_out), "/tmp/bench-allocs.%ld", (long) getpid());
+
+    for (; i < argc; i++)
+    {
+        char const * json = argv[i];
+        size_t const size = strlen(json);
+        if (size < 5 || strcmp(json + size - 5, ".json"))
+        {
+            FAIL("expected a .json corpus, got %s\n", json);
+        }
+        char sexp[PATH_MAX];
+        snprintf(sexp, sizeof(sexp), "%.*s.sexp", (int) (size - 5), json);
+        char const * slash = strrchr(json, '/');
+        char corpus[PATH_MAX];
+        snprintf(corpus, sizeof(corpus), "%.*s", (int) (json + size - 5 - (slash ? slash + 1 : json)),
+                 slash ? slash + 1 : json);
+
+        u64 const docs = count_lines(json);
+        bench(corpus, "json2sexp", "tree", json, docs, runs);
+        bench(corpus, "json2sexp", "stream", json, docs, runs);
+        bench(corpus, "sexp2json", "tree", sexp, docs, runs);
+        bench(corpus, "sexp2json", "stream", sexp, docs, runs);
+    }
+    unlink(g_allocs_out);
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "../lisp.h"
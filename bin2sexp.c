@@ -0,0 +1,116 @@
+#define _DEFAULT_SOURCE
+
+#include "lisp.h"
+#include "binary.h"
+#include "input.h"
+#include "output.h"
+#include "scan.h"
+#include "sexp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* bin2sexp reads binary streams and writes the values in them as
+ * s-expressions; the writer lays out objects and arrays as json2sexp does,
+ * so that what json2sexp writes comes back unchanged */
+
+static Input g_in;
+static BinaryReader g_reader;
+
+static Output g_out;
+static SexpWriter g_writer;
+
+static bool g_compact = false;
+
+static void flush_output()
+{
+    output_flush(&g_out);
+}
+
+static void bin2sexp()
+{
+    if (input_resident(&g_in))
+    {
+        string_set_source(g_in.map, g_in.map_size);
+    }
+
+    /* the names of the stream are kept while the values are dropped */
+    binary_reader_open(&g_reader, &g_in);
+    sexp_writer_open(&g_writer, &g_out, g_compact);
+    HeapMark mark = heap_mark();
+    Expr exp;
+    while (binary_read(&g_reader, &exp))
+    {
+        sexp_write(&g_writer, exp);
+        sexp_write_end(&g_writer);
+        heap_keep_names(&mark);
+        heap_rewind(mark);
+    }
+    sexp_writer_close(&g_writer);
+    binary_reader_close(&g_reader);
+}
+
+int main(int argc, char ** argv)
+{
+    scan_init();
+    output_open_fd(&g_out, 1);
+    atexit(flush_output);
+
+    char ** files = argv + 1;
+    int num_files = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--compact"))
+        {
+            g_compact = true;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            FAIL("unknown option %s\n", argv[i]);
+        }
+        else
+        {
+            files[num_files++] = argv[i];
+        }
+    }
+
+    if (num_files == 0)
+    {
+        input_open_fd(&g_in, 0);
+        bin2sexp();
+        input_close(&g_in);
+    }
+    for (int i = 0; i < num_files; i++)
+    {
+        if (!strcmp(files[i], "-"))
+        {
+            input_open_fd(&g_in, 0);
+        }
+        else
+        {
+            input_open_file(&g_in, files[i]);
+        }
+        bin2sexp();
+        input_close(&g_in);
+    }
+    output_close(&g_out);
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "lisp.h"
+
+#define BINARY_IMPLEMENTATION
+#include "binary.h"
+
+#define INPUT_IMPLEMENTATION
+#include "input.h"
+
+#define OUTPUT_IMPLEMENTATION
+#include "output.h"
+
+#define SCAN_IMPLEMENTATION
+#include "scan.h"
+
+#define SEXP_IMPLEMENTATION
+#include "sexp.h"
@@ -0,0 +1,597 @@
+
+#ifndef _BINARY_H_
+#define _BINARY_H_
+
+#include "lisp.h"
+#include "input.h"
+#include "output.h"
+
+/* binary s-expressions
+ *
+ * a stream is a sequence of items. every item starts with a header, which
+ * is a varint of n << 4 | tag; a varint has 7 bits in each byte, the low
+ * ones first, and the high bit is set in every byte but the last:
+ *
+ *   BINARY_NIL          nil; with n other than 0, the start of a stream in
+ *                       version n of the format
+ *   BINARY_SYMBOL       the symbol with id n
+ *   BINARY_KEYWORD      the keyword with id n
+ *   BINARY_LIST         a list of the n items that follow
+ *   BINARY_DOTTED       a list of the n items that follow and then one more
+ *                       item, which is the cdr of its last pair
+ *   BINARY_STRING       a string of the n bytes that follow
+ *   BINARY_NEW_SYMBOL   a symbol named by the n bytes that follow, which is
+ *                       given the next symbol id
+ *   BINARY_NEW_KEYWORD  the same for keywords
+ *   BINARY_INTEGER      the integer that n is the zigzag encoding of (0, -1,
+ *                       1, -2, ... are 0, 1, 2, 3, ...)
+ *   BINARY_NUMBER       an integer if n is 0 or a double if n is 1, in the 8
+ *                       bytes that follow, the low byte first
+ *   BINARY_NUMBER_TEXT  a number that keeps the n bytes of text that follow
+ *
+ * so a symbol or keyword is named once in a stream, where it is first
+ * used, and is only referred to by its id after that; the ids count up
+ * from 0 in the order of the names. every value after the start of a
+ * stream is one item. streams can be concatenated, as each one starts
+ * afresh with no names.
+ *
+ * the writer identifies names by their index in the heap, so the symbols
+ * and keywords it has written must not be dropped while it is open (see
+ * heap_keep_names). the reader interns every name once, when it is
+ * defined, and the same holds for those. */
+
+enum
+{
+    BINARY_NIL = 0,
+    BINARY_SYMBOL,
+    BINARY_KEYWORD,
+    BINARY_LIST,
+    BINARY_DOTTED,
+    BINARY_STRING,
+    BINARY_NEW_SYMBOL,
+    BINARY_NEW_KEYWORD,
+    BINARY_INTEGER,
+    BINARY_NUMBER,
+    BINARY_NUMBER_TEXT,
+};
+
+#define BINARY_TAG_BITS 4
+#define BINARY_TAG_MASK ((1 << BINARY_TAG_BITS) - 1)
+#define BINARY_VERSION 2
+
+typedef struct
+{
+    u64 * ids;      /* id + 1 by the index of a name, 0 if it has none yet */
+    u64 max_ids;
+    u64 num_names;
+} BinaryNameIds;
+
+typedef struct
+{
+    Output * out;
+    BinaryNameIds symbols;
+    BinaryNameIds keywords;
+    Expr * rests;   /* the rest of each list that is being written */
+    size_t num_rests;
+    size_t max_rests;
+} BinaryWriter;
+
+/* starts a stream on out */
+void binary_writer_open(BinaryWriter * writer, Output * out);
+void binary_writer_close(BinaryWriter * writer);
+void binary_write(BinaryWriter * writer, Expr exp);
+
+typedef struct
+{
+    Expr * names;   /* by id */
+    u64 num_names;
+    u64 max_names;
+} BinaryNames;
+
+typedef struct
+{
+    Expr head;
+    Expr tail;
+    u64 left;       /* the number of items that are still to come */
+    bool dotted;
+} BinaryFrame;
+
+typedef struct
+{
+    Input * in;
+    BinaryNames symbols;
+    BinaryNames keywords;
+    BinaryFrame * frames;
+    size_t num_frames;
+    size_t max_frames;
+    bool started;
+} BinaryReader;
+
+void binary_reader_open(BinaryReader * reader, Input * in);
+void binary_reader_close(BinaryReader * reader);
+
+/* reads the next value into pexp, returns false at the end of the input */
+bool binary_read(BinaryReader * reader, Expr * pexp);
+
+#endif /* _BINARY_H_ */
+
+#ifdef BINARY_IMPLEMENTATION
+
+#ifndef _BINARY_C_
+#define _BINARY_C_
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BINARY_MAX_VARINT 10
+
+static void _binary_write_header(Output * out, u64 tag, u64 n)
+{
+    /* n is at most 60 bits, so the header does not overflow */
+    ASSERT_DEBUG(n >> (64 - BINARY_TAG_BITS) == 0);
+    u64 value = n << BINARY_TAG_BITS | tag;
+    char buffer[BINARY_MAX_VARINT];
+    size_t size = 0;
+    while (value >= 128)
+    {
+        buffer[size++] = (char) (value | 128);
+        value >>= 7;
+    }
+    buffer[size++] = (char) value;
+    output_write(out, buffer, size);
+}
+
+void binary_writer_open(BinaryWriter * writer, Output * out)
+{
+    memset(writer, 0, sizeof(BinaryWriter));
+    writer->out = out;
+    _binary_write_header(out, BINARY_NIL, BINARY_VERSION);
+}
+
+void binary_writer_close(BinaryWriter * writer)
+{
+    free(writer->symbols.ids);
+    free(writer->keywords.ids);
+    free(writer->rests);
+    memset(writer, 0, sizeof(BinaryWriter));
+}
+
+/* writes a symbol or keyword by the index of its name, naming it first if
+ * it has no id in the stream yet */
+static void _binary_write_name(Output * out, BinaryNameIds * ids, u64 index, u64 tag, u64 new_tag,
+                               char const * name, size_t size)
+{
+    if (index >= ids->max_ids)
+    {
+        u64 max_ids = ids->max_ids ? ids->max_ids : 256;
+        while (max_ids <= index)
+        {
+            max_ids *= 2;
+        }
+        ids->ids = (u64 *) realloc(ids->ids, max_ids * sizeof(u64));
+        ASSERT(ids->ids);
+        memset(ids->ids + ids->max_ids, 0, (max_ids - ids->max_ids) * sizeof(u64));
+        ids->max_ids = max_ids;
+    }
+    if (ids->ids[index])
+    {
+        _binary_write_header(out, tag, ids->ids[index] - 1);
+        return;
+    }
+    ids->ids[index] = ++ids->num_names;
+    _binary_write_header(out, new_tag, size);
+    output_write(out, name, size);
+}
+
+static void _binary_write_number(Output * out, Expr exp)
+{
+    size_t size;
+    char const * lexeme = number_lexeme(exp, &size);
+    if (lexeme)
+    {
+        _binary_write_header(out, BINARY_NUMBER_TEXT, size);
+        output_write(out, lexeme, size);
+        return;
+    }
+    bool const integer = number_is_integer(exp);
+    u64 bits;
+    if (integer)
+    {
+        bits = (u64) number_integer(exp);
+    }
+    else
+    {
+        double const val = number_double(exp);
+        memcpy(&bits, &val, sizeof(u64));
+    }
+    char bytes[8];
+    for (int i = 0; i < 8; i++)
+    {
+        bytes[i] = (char) (bits >> 8 * i);
+    }
+    _binary_write_header(out, BINARY_NUMBER, integer ? 0 : 1);
+    output_write(out, bytes, 8);
+}
+
+static void _binary_write_atom(BinaryWriter * writer, Expr exp)
+{
+    switch (expr_type(exp))
+    {
+    case TYPE_NIL:
+        _binary_write_header(writer->out, BINARY_NIL, 0);
+        break;
+    case TYPE_SYMBOL:
+        _binary_write_name(writer->out, &writer->symbols, expr_data(exp), BINARY_SYMBOL, BINARY_NEW_SYMBOL,
+                           symbol_name(exp), symbol_size(exp));
+        break;
+    case TYPE_KEYWORD:
+        _binary_write_name(writer->out, &writer->keywords, expr_data(exp), BINARY_KEYWORD, BINARY_NEW_KEYWORD,
+                           keyword_name(exp), keyword_size(exp));
+        break;
+    case TYPE_STRING:
+    case TYPE_SLICE:
+    case TYPE_SHORT_STRING:
+    {
+        size_t const size = string_size(exp);
+        char buffer[STRING_SHORT_SIZE];
+        _binary_write_header(writer->out, BINARY_STRING, size);
+        output_write(writer->out, string_value(exp, buffer), size);
+        break;
+    }
+    case TYPE_NUMBER:
+    {
+        /* an immediate has 56 bits, so its zigzag encoding fits in n */
+        int64_t const val = number_integer(exp);
+        _binary_write_header(writer->out, BINARY_INTEGER, ((u64) val << 1) ^ (u64) (val >> 63));
+        break;
+    }
+    case TYPE_BOXED_NUMBER:
+        _binary_write_number(writer->out, exp);
+        break;
+    default:
+        FAIL("cannot write expression %016" PRIx64 " in binary\n", exp);
+        break;
+    }
+}
+
+static void _binary_write_list(BinaryWriter * writer, Expr exp)
+{
+    u64 count = 0;
+    Expr rest = exp;
+    while (is_pair(rest))
+    {
+        count++;
+        rest = cdr(rest);
+    }
+    _binary_write_header(writer->out, is_nil(rest) ? BINARY_LIST : BINARY_DOTTED, count);
+
+    if (writer->num_rests == writer->max_rests)
+    {
+        writer->max_rests = writer->max_rests ? 2 * writer->max_rests : 64;
+        writer->rests = (Expr *) realloc(writer->rests, writer->max_rests * sizeof(Expr));
+        ASSERT(writer->rests);
+    }
+    writer->rests[writer->num_rests++] = exp;
+}
+
+/* the writer walks lists with a stack of its own, like the readers and
+ * renderers of the tools, so it does not recurse */
+void binary_write(BinaryWriter * writer, Expr exp)
+{
+    size_t const base = writer->num_rests;
+    while (true)
+    {
+        if (is_pair(exp))
+        {
+            _binary_write_list(writer, exp);
+        }
+        else
+        {
+            _binary_write_atom(writer, exp);
+        }
+
+        /* move on to the next item, dropping the lists that are done */
+        while (true)
+        {
+            if (writer->num_rests == base)
+            {
+                return;
+            }
+            Expr * rest = &writer->rests[writer->num_rests - 1];
+            if (is_pair(*rest))
+            {
+                exp = car(*rest);
+                *rest = cdr(*rest);
+                break;
+            }
+            if (is_nil(*rest))
+            {
+                writer->num_rests--;
+                continue;
+            }
+            /* the cdr that ends a dotted list */
+            exp = *rest;
+            *rest = nil;
+            break;
+        }
+    }
+}
+
+void binary_reader_open(BinaryReader * reader, Input * in)
+{
+    memset(reader, 0, sizeof(BinaryReader));
+    reader->in = in;
+}
+
+void binary_reader_close(BinaryReader * reader)
+{
+    free(reader->symbols.names);
+    free(reader->keywords.names);
+    free(reader->frames);
+    memset(reader, 0, sizeof(BinaryReader));
+}
+
+/* makes sure that size bytes can be read in one run, unless the input
+ * ends first */
+static void _binary_need(Input * in, size_t size)
+{
+    while ((size_t) (in->end - in->cur) < size && input_fill(in))
+    {
+    }
+}
+
+static u64 _binary_read_header(Input * in)
+{
+    if (in->end - in->cur < BINARY_MAX_VARINT)
+    {
+        _binary_need(in, BINARY_MAX_VARINT);
+    }
+    u64 value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (in->cur == in->end)
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+        }
+        unsigned char const byte = (unsigned char) *in->cur++;
+        value |= (u64) (byte & 127) << shift;
+        if (byte < 128)
+        {
+            return value;
+        }
+    }
+    FAIL("bad item header in binary input\n");
+    return 0;
+}
+
+/* the n bytes of an atom, which are left in the input as one run */
+static char const * _binary_read_bytes(Input * in, u64 size)
+{
+    _binary_need(in, size);
+    if ((u64) (in->end - in->cur) < size)
+    {
+        FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+    }
+    char const * data = in->cur;
+    in->cur += size;
+    return data;
+}
+
+static Expr _binary_read_string(Input * in, u64 size)
+{
+    /* resident input is referenced in place, anything else is copied a
+     * buffer at a time */
+    if (input_resident(in))
+    {
+        return make_string_slice(_binary_read_bytes(in, size), size);
+    }
+    if ((u64) (in->end - in->cur) >= size)
+    {
+        Expr ret = make_string_n(in->cur, size);
+        in->cur += size;
+        return ret;
+    }
+    string_begin();
+    while (size)
+    {
+        if (in->cur == in->end && !input_fill(in))
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+        }
+        size_t const avail = in->end - in->cur;
+        size_t const run = avail < size ? avail : size;
+        string_append(in->cur, run);
+        in->cur += run;
+        size -= run;
+    }
+    return string_end();
+}
+
+static Expr _binary_name(BinaryNames const * names, u64 id)
+{
+    if (id >= names->num_names)
+    {
+        FAIL("undefined name %" PRIu64 " in binary input\n", id);
+    }
+    return names->names[id];
+}
+
+static void _binary_add_name(BinaryNames * names, Expr exp)
+{
+    if (names->num_names == names->max_names)
+    {
+        names->max_names = names->max_names ? 2 * names->max_names : 256;
+        names->names = (Expr *) realloc(names->names, names->max_names * sizeof(Expr));
+        ASSERT(names->names);
+    }
+    names->names[names->num_names++] = exp;
+}
+
+static void _binary_push_frame(BinaryReader * reader, u64 count, bool dotted)
+{
+    if (reader->num_frames == reader->max_frames)
+    {
+        reader->max_frames = reader->max_frames ? 2 * reader->max_frames : 64;
+        reader->frames = (BinaryFrame *) realloc(reader->frames, reader->max_frames * sizeof(BinaryFrame));
+        ASSERT(reader->frames);
+    }
+    BinaryFrame * frame = &reader->frames[reader->num_frames++];
+    frame->head = nil;
+    frame->tail = nil;
+    frame->left = count;
+    frame->dotted = dotted;
+}
+
+bool binary_read(BinaryReader * reader, Expr * pexp)
+{
+    Input * in = reader->in;
+    u64 header;
+    while (true)
+    {
+        if (input_peek(in) == -1)
+        {
+            return false;
+        }
+        header = _binary_read_header(in);
+        if ((header & BINARY_TAG_MASK) != BINARY_NIL || header >> BINARY_TAG_BITS == 0)
+        {
+            break;
+        }
+        /* the start of a stream, which forgets the names before it */
+        if (header >> BINARY_TAG_BITS != BINARY_VERSION)
+        {
+            FAIL("not a binary stream of version %d\n", BINARY_VERSION);
+        }
+        reader->symbols.num_names = 0;
+        reader->keywords.num_names = 0;
+        reader->started = true;
+    }
+    if (!reader->started)
+    {
+        FAIL("not a binary stream of version %d\n", BINARY_VERSION);
+    }
+
+    size_t const base = reader->num_frames;
+    while (true)
+    {
+        u64 const n = header >> BINARY_TAG_BITS;
+        Expr exp = nil;
+        switch (header & BINARY_TAG_MASK)
+        {
+        case BINARY_NIL:
+            if (n)
+            {
+                FAIL("start of a binary stream inside a value\n");
+            }
+            break;
+        case BINARY_SYMBOL:
+            exp = _binary_name(&reader->symbols, n);
+            break;
+        case BINARY_KEYWORD:
+            exp = _binary_name(&reader->keywords, n);
+            break;
+        case BINARY_LIST:
+        case BINARY_DOTTED:
+            if (n || (header & BINARY_TAG_MASK) == BINARY_DOTTED)
+            {
+                _binary_push_frame(reader, n, (header & BINARY_TAG_MASK) == BINARY_DOTTED);
+                header = _binary_read_header(in);
+                continue;
+            }
+            break;
+        case BINARY_STRING:
+            exp = _binary_read_string(in, n);
+            break;
+        case BINARY_NEW_SYMBOL:
+            exp = make_symbol_n(_binary_read_bytes(in, n), n);
+            _binary_add_name(&reader->symbols, exp);
+            break;
+        case BINARY_NEW_KEYWORD:
+            exp = make_keyword_n(_binary_read_bytes(in, n), n);
+            _binary_add_name(&reader->keywords, exp);
+            break;
+        case BINARY_INTEGER:
+            exp = make_integer((int64_t) (n >> 1) ^ -(int64_t) (n & 1));
+            break;
+        case BINARY_NUMBER:
+        {
+            unsigned char const * bytes = (unsigned char const *) _binary_read_bytes(in, 8);
+            u64 bits = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                bits |= (u64) bytes[i] << 8 * i;
+            }
+            if (n == 0)
+            {
+                exp = make_integer((int64_t) bits);
+            }
+            else
+            {
+                double val;
+                memcpy(&val, &bits, sizeof(double));
+                exp = make_double(val);
+            }
+            break;
+        }
+        case BINARY_NUMBER_TEXT:
+            if (!parse_number(_binary_read_bytes(in, n), n, true, &exp))
+            {
+                FAIL("bad number in binary input\n");
+            }
+            break;
+        default:
+            FAIL("bad item header in binary input\n");
+            break;
+        }
+
+        /* add the item to the lists it ends up in, closing those that are
+         * complete */
+        while (true)
+        {
+            if (reader->num_frames == base)
+            {
+                *pexp = exp;
+                return true;
+            }
+            BinaryFrame * frame = &reader->frames[reader->num_frames - 1];
+            if (frame->left == 0)
+            {
+                /* the cdr of a dotted list */
+                if (frame->head)
+                {
+                    rplacd(frame->tail, exp);
+                }
+                else
+                {
+                    frame->head = exp;
+                }
+                exp = frame->head;
+                reader->num_frames--;
+                continue;
+            }
+            Expr next = cons(exp, nil);
+            if (frame->head)
+            {
+                rplacd(frame->tail, next);
+            }
+            else
+            {
+                frame->head = next;
+            }
+            frame->tail = next;
+            if (--frame->left == 0 && !frame->dotted)
+            {
+                exp = frame->head;
+                reader->num_frames--;
+                continue;
+            }
+            break;
+        }
+        header = _binary_read_header(in);
+    }
+}
+
+#endif /* _BINARY_C_ */
+
+#endif
@@ -0,0 +1,267 @@
+
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include "lisp.h"
+
+/* block-buffered input
+ *
+ * bytes are read with read(2) into a buffer that the lexers scan through
+ * pointers; cur..end is the unread part of the buffer. a token that is
+ * being scanned is kept in the buffer across refills, so it can always be
+ * looked at as one contiguous run starting at token. in the same way, the
+ * input from a mark on is kept until the mark is cleared, so that it can
+ * be read again by going back to it.
+ *
+ * regular files are mapped instead and scanned in place; the whole file is
+ * then one buffer and there is never anything to refill. input can also be
+ * a run of memory owned by the caller, which is scanned the same way. */
+
+typedef struct
+{
+    char const * cur;
+    char const * end;
+    char const * token;
+    char const * mark;
+    char * buffer;
+    size_t capacity;
+    char const * map;
+    size_t map_size;
+    int fd;
+    bool eof;
+} Input;
+
+void input_open_fd(Input * in, int fd);
+void input_open_file(Input * in, char const * path);
+void input_open_memory(Input * in, char const * data, size_t size);
+void input_close(Input * in);
+
+/* true if all of the input is in memory for as long as it is open, so
+ * pointers into it stay valid across refills */
+inline static bool input_resident(Input const * in)
+{
+    return in->map != NULL;
+}
+
+/* refills the buffer, returns false if there is nothing left to read */
+bool input_fill(Input * in);
+
+inline static int input_peek(Input * in)
+{
+    if (in->cur < in->end || input_fill(in))
+    {
+        return (unsigned char) *in->cur;
+    }
+    return -1;
+}
+
+inline static void input_advance(Input * in)
+{
+    ASSERT_DEBUG(in->cur < in->end);
+    in->cur++;
+}
+
+inline static void input_begin_token(Input * in)
+{
+    ASSERT_DEBUG(!in->token);
+    in->token = in->cur;
+}
+
+inline static size_t input_token_size(Input * in)
+{
+    ASSERT_DEBUG(in->token);
+    return in->cur - in->token;
+}
+
+inline static void input_end_token(Input * in)
+{
+    ASSERT_DEBUG(in->token);
+    in->token = NULL;
+}
+
+inline static void input_set_mark(Input * in)
+{
+    ASSERT_DEBUG(!in->mark && !in->token);
+    in->mark = in->cur;
+}
+
+inline static void input_clear_mark(Input * in)
+{
+    ASSERT_DEBUG(in->mark);
+    in->mark = NULL;
+}
+
+/* goes back to the mark and clears it */
+inline static void input_reset_to_mark(Input * in)
+{
+    ASSERT_DEBUG(in->mark && !in->token);
+    in->cur = in->mark;
+    in->mark = NULL;
+}
+
+#endif /* _INPUT_H_ */
+
+#ifdef INPUT_IMPLEMENTATION
+
+#ifndef _INPUT_C_
+#define _INPUT_C_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INPUT_BUFFER_SIZE ((size_t) 1 << 18)
+
+static bool _input_map(Input * in)
+{
+    struct stat st;
+    if (fstat(in->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        return false;
+    }
+    /* the file has to be mapped from its start, so skip what has already
+     * been consumed from the descriptor */
+    off_t const pos = lseek(in->fd, 0, SEEK_CUR);
+    if (pos < 0 || pos >= st.st_size)
+    {
+        return false;
+    }
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    (void) madvise(map, st.st_size, MADV_SEQUENTIAL);
+    in->map = (char const *) map;
+    in->map_size = st.st_size;
+    in->cur = in->map + pos;
+    in->end = in->map + st.st_size;
+    in->eof = true;
+    return true;
+}
+
+void input_open_fd(Input * in, int fd)
+{
+    in->token = NULL;
+    in->mark = NULL;
+    in->buffer = NULL;
+    in->capacity = 0;
+    in->map = NULL;
+    in->map_size = 0;
+    in->fd = fd;
+    in->eof = false;
+    if (_input_map(in))
+    {
+        return;
+    }
+    in->buffer = (char *) malloc(INPUT_BUFFER_SIZE);
+    ASSERT(in->buffer);
+    in->capacity = INPUT_BUFFER_SIZE;
+    in->cur = in->end = in->buffer;
+}
+
+void input_open_file(Input * in, char const * path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        FAIL("cannot open %s: %s\n", path, strerror(errno));
+    }
+    input_open_fd(in, fd);
+}
+
+void input_open_memory(Input * in, char const * data, size_t size)
+{
+    in->token = NULL;
+    in->mark = NULL;
+    in->buffer = NULL;
+    in->capacity = 0;
+    in->map = data;
+    in->map_size = size;
+    in->fd = -1;
+    in->eof = true;
+    in->cur = data;
+    in->end = data + size;
+}
+
+void input_close(Input * in)
+{
+    if (in->map && in->fd >= 0)
+    {
+        munmap((void *) in->map, in->map_size);
+    }
+    free(in->buffer);
+    if (in->fd > 0)
+    {
+        close(in->fd);
+    }
+    in->cur = in->end = in->token = in->mark = NULL;
+    in->buffer = NULL;
+    in->map = NULL;
+}
+
+bool input_fill(Input * in)
+{
+    if (in->eof)
+    {
+        return false;
+    }
+
+    /* move what still has to be kept to the front, growing the buffer
+     * when a single token fills all of it; the mark is never after the
+     * token */
+    char const * from = in->mark ? in->mark : in->token ? in->token : in->cur;
+    size_t const kept = in->end - from;
+    size_t const cur = in->cur - from;
+    size_t const token = in->token ? (size_t) (in->token - from) : 0;
+    if (kept == in->capacity)
+    {
+        in->capacity *= 2;
+        char * buffer = (char *) malloc(in->capacity);
+        ASSERT(buffer);
+        memcpy(buffer, from, kept);
+        free(in->buffer);
+        in->buffer = buffer;
+    }
+    else if (from != in->buffer)
+    {
+        memmove(in->buffer, from, kept);
+    }
+    if (in->mark)
+    {
+        in->mark = in->buffer;
+    }
+    if (in->token)
+    {
+        in->token = in->buffer + token;
+    }
+    in->cur = in->buffer + cur;
+    in->end = in->buffer + kept;
+
+    ssize_t count;
+    do
+    {
+        count = read(in->fd, in->buffer + kept, in->capacity - kept);
+    }
+    while (count < 0 && errno == EINTR);
+
+    if (count < 0)
+    {
+        FAIL("read failed: %s\n", strerror(errno));
+    }
+    if (count == 0)
+    {
+        in->eof = true;
+        return false;
+    }
+    in->end += count;
+    return true;
+}
+
+#endif /* _INPUT_C_ */
+
+#endif
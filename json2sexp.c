@@ -1,45 +1,47 @@
 
+#define _DEFAULT_SOURCE
+
 #include "lisp.h"
+#include "input.h"
+#include "output.h"
+#include "parallel.h"
+#include "path.h"
+#include "scan.h"
+#include "sexp.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static bool is_whitespace(int ch)
-{
-    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
-}
+/* with -j the conversion runs on worker threads, so everything that one
+ * conversion reads or writes is private to its thread */
 
-static int peek_ch = -1;
+static THREAD_LOCAL Input g_in;
 
 static int peek()
 {
-    if (peek_ch == -1)
-    {
-        FILE * in = stdin;
-        peek_ch = getc(in);
-        ungetc(peek_ch, in);
-    }
-    //fprintf(stderr, "peek: '%c' (%d)\n", peek_ch, peek_ch);
-    return peek_ch;
+    //fprintf(stderr, "peek: '%c' (%d)\n", *g_in.cur, *g_in.cur);
+    return input_peek(&g_in);
 }
 
 static void advance()
 {
-    (void) getc(stdin);
-    //fprintf(stderr, "advance: '%c' (%d)\n", ch, ch);
-    peek_ch = -1;
+    //fprintf(stderr, "advance: '%c' (%d)\n", *g_in.cur, *g_in.cur);
+    input_advance(&g_in);
 }
 
-static bool at_whitespace()
-{
-    return is_whitespace(peek());
-}
+/* resident input has a structural index, which jumps over whitespace to
+ * the start of the next token */
+static THREAD_LOCAL ScanIndex g_index;
+
+/* the reader that follows --select and --where skips whitespace for the
+ * rest of the reading too */
+static THREAD_LOCAL PathReader g_path;
 
 static void skip_whitespace()
 {
-    while (at_whitespace())
-    {
-        (void) advance();
-    }
+    path_skip_whitespace(&g_path);
 }
 
 static bool at_eof()
@@ -60,487 +62,663 @@ char const * expr_type_name(Expr exp)
     case TYPE_PAIR:
         return "pair";
     case TYPE_STRING:
+    case TYPE_SLICE:
+    case TYPE_SHORT_STRING:
         return "string";
+    case TYPE_NUMBER:
+    case TYPE_BOXED_NUMBER:
+        return "number";
     default:
         return "#:<unknown>";
     }
 }
 
-static Expr read_value();
-static Expr read_string();
-static Expr read_symbol();
+/* scans an atom and leaves it as the current token of the input */
+static void read_token()
+{
+    input_begin_token(&g_in);
+    do
+    {
+        g_in.cur = scan_json_atom(g_in.cur, g_in.end);
+    }
+    while (g_in.cur == g_in.end && input_fill(&g_in));
+
+    //fprintf(stderr, "TOKEN: %.*s\n", (int) input_token_size(&g_in), g_in.token);
+}
+
+/* numbers keep the text they were read from when they would not be
+ * written back the same way, unless --normalize-numbers is given */
+static bool g_exact_numbers = true;
 
-static Expr read_object()
+/* numbers are read as such, any other atom is interned */
+static Expr read_atom()
 {
     //fprintf(stderr, "%s()\n", __FUNCTION__);
-    ASSERT(peek() == '{');
-    (void) advance();
-
-    Expr head = nil, tail = nil;
-    while (true)
+    read_token();
+    Expr ret;
+    if (!parse_number(g_in.token, input_token_size(&g_in), g_exact_numbers, &ret))
     {
-        skip_whitespace();
-        int ch = peek();
-        if (ch == '}')
-        {
-            (void) advance();
-            break;
-        }
-        else if (ch == -1)
-        {
-            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
-            return nil;
-        }
-        else
-        {
-            Expr key = read_string();
-            Expr colon = read_symbol();
-            ASSERT(colon == intern(":"));
-            Expr val = read_value();
+        ret = intern_n(g_in.token, input_token_size(&g_in));
+    }
+    input_end_token(&g_in);
+    return ret;
+}
 
-            Expr next = cons(make_keyword(string_value(key)), cons(val, nil));
-            if (head)
-            {
-                rplacd(tail, next);
-                tail = next;
-            }
-            else
-            {
-                head = tail = next;
-            }
-            skip_whitespace();
-            bool have_comma = false;
-            if (peek() == ',')
-            {
-                have_comma = true;
-                advance();
-            }
-            if (have_comma && peek() == '}')
-            {
-                FAIL("unexpected '}' after ',' in %s()\n", __FUNCTION__);
-            }
-        }
+/* the reader keeps the objects and arrays it is in on a stack of its own
+ * instead of recursing, so nesting is only limited by memory */
+
+enum
+{
+    FRAME_OBJECT,
+    FRAME_ARRAY,
+};
+
+typedef struct
+{
+    Expr head;
+    Expr tail;
+    Expr key;
+    int kind;
+} Frame;
+
+static THREAD_LOCAL Frame * g_frames = NULL;
+static THREAD_LOCAL size_t g_num_frames = 0;
+static THREAD_LOCAL size_t g_max_frames = 0;
+
+static void push_frame(int kind)
+{
+    if (g_num_frames == g_max_frames)
+    {
+        g_max_frames = g_max_frames ? 2 * g_max_frames : 64;
+        g_frames = (Frame *) realloc(g_frames, g_max_frames * sizeof(Frame));
+        ASSERT(g_frames);
     }
-    return cons(intern("object"), head);
+    Frame * frame = &g_frames[g_num_frames++];
+    frame->head = nil;
+    frame->tail = nil;
+    frame->key = nil;
+    frame->kind = kind;
 }
 
-static Expr read_array()
+static Expr pop_frame()
 {
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    ASSERT(peek() == '[');
-    (void) advance();
+    Frame const * frame = &g_frames[--g_num_frames];
+    return cons(frame->kind == FRAME_OBJECT ? sym_object : sym_array, frame->head);
+}
 
-    Expr head = nil, tail = nil;
-    while (true)
+/* starts the next member or element of the innermost object or array;
+ * returns false and consumes the closing bracket if there is none */
+static bool begin_item()
+{
+    Frame * frame = &g_frames[g_num_frames - 1];
+    skip_whitespace();
+    int ch = peek();
+    if (ch == (frame->kind == FRAME_OBJECT ? '}' : ']'))
     {
-        skip_whitespace();
-        int ch = peek();
-        if (ch == ']')
+        advance();
+        return false;
+    }
+    else if (ch == -1)
+    {
+        FAIL("unexpected end of stream in %s\n", frame->kind == FRAME_OBJECT ? "object" : "array");
+    }
+
+    if (frame->kind == FRAME_OBJECT)
+    {
+        if (ch != '"')
         {
-            (void) advance();
-            break;
+            FAIL("expected '\"' at the start of an object key, got '%c'\n", ch);
         }
-        else if (ch == -1)
+        Expr key = sexp_read_string(&g_in);
+        char buffer[STRING_SHORT_SIZE];
+        frame->key = make_keyword_n(string_value(key, buffer), string_size(key));
+        skip_whitespace();
+        if (peek() != ':')
         {
-            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
-            return nil;
-        }
-        else
-        {
-            Expr val = read_value();
-            Expr next = cons(val, nil);
-            if (head)
-            {
-                rplacd(tail, next);
-                tail = next;
-            }
-            else
-            {
-                head = tail = next;
-            }
-
-            skip_whitespace();
-            bool have_comma = false;
-            if (peek() == ',')
-            {
-                have_comma = true;
-                advance();
-            }
-            if (have_comma && peek() == ']')
-            {
-                FAIL("unexpected ']' after ',' in %s()\n", __FUNCTION__);
-            }
+            FAIL("expected ':' after object key\n");
         }
+        advance();
     }
-    return cons(intern("array"), head);
+    return true;
 }
 
-static char * _store(size_t size, char * buffer, char ch, char * pout)
+/* adds a value to the innermost object or array and consumes the comma
+ * after it, if there is one */
+static void end_item(Expr val)
 {
-    //fprintf(stderr, "STORE: %c (%d)\n", ch, ch);
-    ASSERT((size_t) (pout - buffer) < size);
-    *pout++ = ch;
-    return pout;
+    Frame * frame = &g_frames[g_num_frames - 1];
+    Expr next = cons(val, nil);
+    if (frame->kind == FRAME_OBJECT)
+    {
+        next = cons(frame->key, next);
+    }
+    if (frame->head)
+    {
+        rplacd(frame->tail, next);
+    }
+    else
+    {
+        frame->head = next;
+    }
+    frame->tail = frame->kind == FRAME_OBJECT ? cdr(next) : next;
+
+    skip_whitespace();
+    if (peek() == ',')
+    {
+        advance();
+        skip_whitespace();
+        char const close = frame->kind == FRAME_OBJECT ? '}' : ']';
+        if (peek() == close)
+        {
+            FAIL("unexpected '%c' after ','\n", close);
+        }
+    }
 }
 
-static Expr read_string()
+static Expr read_value()
 {
     //fprintf(stderr, "%s()\n", __FUNCTION__);
-    ASSERT(peek() == '"');
-    (void) advance();
-
-    char buffer[4096];
-    char * pout = buffer;
-    //fprintf(stderr, "%c", peek());
+    size_t const base = g_num_frames;
     while (true)
     {
+        Expr val = nil;
+        skip_whitespace();
         int ch = peek();
-        if (ch == -1)
+        switch (ch)
         {
+        case '{':
+        case '[':
+            advance();
+            push_frame(ch == '{' ? FRAME_OBJECT : FRAME_ARRAY);
+            if (begin_item())
+            {
+                continue;
+            }
+            val = pop_frame();
+            break;
+        case '"':
+            val = sexp_read_string(&g_in);
+            break;
+        case -1:
             FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
             return nil;
-        }
-        else if (ch == '"')
-        {
+        default:
+            val = read_atom();
             break;
         }
-        else if (ch == '\\')
+        //fprintf(stderr, "READ => %016" PRIx64 " (%s)\n", val, expr_type_name(val));
+
+        /* hand the value to the enclosing frames, closing all that end */
+        while (true)
         {
-            advance();
-            ch = peek();
-            switch (ch)
+            if (g_num_frames == base)
+            {
+                return val;
+            }
+            end_item(val);
+            if (begin_item())
             {
-            case '\\':
-                pout = _store(4096, buffer, '\\', pout);
-                advance();
-                break;
-            case '"':
-                pout = _store(4096, buffer, '"', pout);
-                advance();
                 break;
-            default:
-                FAIL("illegal escape sequence %c\n", ch);
-                return nil;
             }
-        }
-        else
-        {
-            //fprintf(stderr, "%c", peek());
-            pout = _store(4096, buffer, ch, pout);
-            advance();
+            val = pop_frame();
         }
     }
+}
 
-    ASSERT(peek() == '"');
-    (void) advance();
+static THREAD_LOCAL Output g_out;
 
-    pout = _store(4096, buffer, '\0', pout);
-    //fprintf(stderr, "%s\n", buffer);
+static THREAD_LOCAL SexpWriter g_writer;
 
-    return make_string(buffer);
+static void flush_output()
+{
+    output_flush(&g_out);
 }
 
-static bool is_symbol_char(int ch)
-{
-    if (ch == -1)
-    {
-        return false;
-    }
+static bool g_compact = false;
 
-    if (is_whitespace(ch))
-    {
-        return false;
-    }
+/* streaming turns tokens into writer calls as they are read, without
+ * building a tree; a stack of its own holds the objects and arrays that
+ * are open, so memory only grows with the nesting depth */
 
-    if (ch == '(' || ch == ')')
-    {
-        return false;
-    }
+static bool g_stream = false;
+
+typedef struct
+{
+    bool object;
+    bool first;
+} StreamFrame;
+
+static THREAD_LOCAL StreamFrame * g_stream_frames = NULL;
+static THREAD_LOCAL size_t g_num_stream_frames = 0;
+static THREAD_LOCAL size_t g_max_stream_frames = 0;
 
-    if (ch == '{' || ch == '}')
+static void push_stream_frame(bool object)
+{
+    if (g_num_stream_frames == g_max_stream_frames)
     {
-        return false;
+        g_max_stream_frames = g_max_stream_frames ? 2 * g_max_stream_frames : 64;
+        g_stream_frames = (StreamFrame *) realloc(g_stream_frames, g_max_stream_frames * sizeof(StreamFrame));
+        ASSERT(g_stream_frames);
     }
+    g_stream_frames[g_num_stream_frames].object = object;
+    g_stream_frames[g_num_stream_frames].first = true;
+    g_num_stream_frames++;
+}
 
-    if (ch == '[' || ch == ']')
+static void stream_atom()
+{
+    if (peek() == '"')
     {
-        return false;
+        HeapMark const mark = heap_mark();
+        Expr str = sexp_read_string(&g_in);
+        char buffer[STRING_SHORT_SIZE];
+        sexp_write_string(&g_writer, string_value(str, buffer), string_size(str));
+        heap_rewind(mark);
+        return;
     }
 
-    if (ch == ',')
+    /* the tree would hold the interned token, which prints as itself, or a
+     * number, which does too unless --normalize-numbers is given */
+    read_token();
+    HeapMark const mark = heap_mark();
+    Expr num;
+    if (!g_exact_numbers && parse_number(g_in.token, input_token_size(&g_in), false, &num))
     {
-        return false;
+        sexp_write_atom(&g_writer, num);
+        heap_rewind(mark);
     }
-
-    if (ch == '"')
+    else
     {
-        return false;
+        sexp_write_text(&g_writer, g_in.token, input_token_size(&g_in));
     }
-
-    return true;
+    input_end_token(&g_in);
 }
 
-static Expr read_symbol()
+static void stream_value()
 {
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    char buffer[4096];
-    char * pout = buffer;
-    //fprintf(stderr, "%c", peek());
-    while (is_symbol_char(peek()))
+    size_t const base = g_num_stream_frames;
+    bool want_value = true;
+    while (true)
     {
-        int ch = peek();
-        advance();
-        //fprintf(stderr, "%c\n", ch);
-        pout = _store(4096, buffer, ch, pout);
-    }
+        if (want_value)
+        {
+            skip_whitespace();
+            int ch = peek();
+            if (ch == '{' || ch == '[')
+            {
+                advance();
+                push_stream_frame(ch == '{');
+            }
+            else if (ch == -1)
+            {
+                FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+            }
+            else
+            {
+                stream_atom();
+            }
+            want_value = false;
+        }
 
-    pout = _store(4096, buffer, '\0', pout);
+        if (g_num_stream_frames == base)
+        {
+            return;
+        }
 
-    //fprintf(stderr, "BUFFER: %s\n", buffer);
+        /* move on to the next item of the innermost object or array */
+        StreamFrame * frame = &g_stream_frames[g_num_stream_frames - 1];
+        bool const first = frame->first;
+        char const close = frame->object ? '}' : ']';
+        skip_whitespace();
+        if (!first && peek() == ',')
+        {
+            advance();
+            skip_whitespace();
+            if (peek() == close)
+            {
+                FAIL("unexpected '%c' after ','\n", close);
+            }
+        }
 
-    return intern(buffer);
-}
+        int ch = peek();
+        if (ch == close)
+        {
+            advance();
+            if (frame->object)
+            {
+                sexp_write_object_end(&g_writer, first);
+            }
+            else
+            {
+                sexp_write_array_end(&g_writer, first);
+            }
+            g_num_stream_frames--;
+            continue;
+        }
+        else if (ch == -1)
+        {
+            FAIL("unexpected end of stream in %s\n", frame->object ? "object" : "array");
+        }
 
-static Expr read_value()
-{
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    Expr ret = nil;
-    skip_whitespace();
-    switch (peek())
-    {
-    case '{':
-        ret = read_object();
-        break;
-    case '[':
-        ret = read_array();
-        break;
-    case '"':
-        ret = read_string();
-        break;
-    default:
-        ret = read_symbol();
-        break;
+        frame->first = false;
+        if (frame->object)
+        {
+            if (ch != '"')
+            {
+                FAIL("expected '\"' at the start of an object key, got '%c'\n", ch);
+            }
+            HeapMark const mark = heap_mark();
+            Expr key = sexp_read_string(&g_in);
+            char buffer[STRING_SHORT_SIZE];
+            sexp_write_object_key(&g_writer, string_value(key, buffer), string_size(key), first);
+            heap_rewind(mark);
+            skip_whitespace();
+            if (peek() != ':')
+            {
+                FAIL("expected ':' after object key\n");
+            }
+            advance();
+        }
+        else
+        {
+            sexp_write_array_item(&g_writer, first);
+        }
+        want_value = true;
     }
-    //fprintf(stderr, "READ => %016" PRIx64 " (%s)\n", ret, expr_type_name(ret));
-    return ret;
 }
 
-static bool maybe_read_value(Expr * pexp)
+/* --select renders only the value at a path in each top-level value. the
+ * path is followed while reading, and everything off the path is skipped
+ * by scanning for the brackets that balance it, without building any of
+ * it; values where the path leads nowhere render nothing */
+
+static Path g_select;
+
+static void select_value()
 {
-    skip_whitespace();
-    if (at_eof())
+    size_t depth;
+    /* json has no key without a value, so a path leads to nil only in the
+     * s-expressions of sexp2json */
+    if (path_follow(&g_path, &g_select, &depth) == PATH_VALUE)
     {
-        return false;
+        if (g_stream)
+        {
+            stream_value();
+        }
+        else
+        {
+            sexp_write(&g_writer, read_value());
+        }
+        sexp_write_end(&g_writer);
     }
-    *pexp = read_value();
-    return true;
+    path_skip_to_close(&g_path, depth);
 }
 
-static void render_expr(Expr exp);
+/* --where drops the top-level values that fail a test. the path of the
+ * test is followed as for --select, and once the test fails the rest of
+ * the value is skipped in the same way; a value that passes is read again
+ * from its start, which a mark keeps in the input */
 
-int g_indent = 0;
-int g_col = 0;
-int g_line = 0;
+static PathTest g_where;
 
-static void emit_char(char ch)
+/* moves to the next top-level value that passes --where, returns false at
+ * the end of the stream */
+static bool next_value()
 {
-    if (ch == '\n')
-    {
-        putc('\n', stdout);
-        g_col = 0;
-        g_line++;
-    }
-    else
+    while (true)
     {
-        if (g_col == 0)
+        skip_whitespace();
+        if (at_eof())
         {
-            for (int i = 0; i < g_indent; i++)
-            {
-                putc(' ', stdout);
-            }
+            return false;
+        }
+        if (!g_where.path.num_steps || path_test_passes(&g_path, &g_where))
+        {
+            return true;
         }
-        putc(ch, stdout);
-        g_col++;
     }
 }
 
-static void emit_str(char const * str)
+static void convert_values()
 {
-    ASSERT_DEBUG(str);
-    for (char const * p = str; *p; p++)
+    /* nothing outlives the value it was read for */
+    HeapMark const mark = heap_mark();
+    while (next_value())
     {
-        emit_char(*p);
+        if (g_select.num_steps)
+        {
+            select_value();
+        }
+        else if (g_stream)
+        {
+            stream_value();
+            sexp_write_end(&g_writer);
+        }
+        else
+        {
+            sexp_write(&g_writer, read_value());
+            sexp_write_end(&g_writer);
+        }
+        heap_rewind(mark);
     }
 }
 
-static void indent()
+static void json2sexp()
 {
-    g_indent += 2;
+    if (input_resident(&g_in))
+    {
+        string_set_source(g_in.map, g_in.map_size);
+        scan_index_open(&g_index, g_in.cur, g_in.end - g_in.cur, true);
+    }
+    path_reader_open(&g_path, &g_in, &g_index, true);
+    sexp_writer_open(&g_writer, &g_out, g_compact);
+    convert_values();
+    sexp_writer_close(&g_writer);
+    if (g_index.offsets)
+    {
+        scan_index_close(&g_index);
+    }
 }
 
-static void dedent()
+/* -j cuts the input into chunks of whole values for the worker threads.
+ * the structural index gives the tokens, and a chunk can end before any
+ * token outside of every object or array that starts a value rather than closing
+ * or separating one */
+
+static int g_num_threads = 1;
+static size_t g_chunk_size = 0;
+
+/* whether a token closes or separates a value, so a chunk cannot start
+ * at it */
+static bool is_value_end(char c)
 {
-    g_indent -= 2;
+    return c == '}' || c == ']' || c == ')' || c == ',' || c == ':';
 }
 
-static void render_nil(Expr exp)
+static size_t split_values(char const * data, size_t size, size_t target)
 {
-    if (is_nil(exp))
+    ScanIndex index;
+    scan_index_open(&index, data, size, true);
+    char const * const end = data + size;
+    char const * p = data;
+    size_t depth = 0;
+    size_t ret = 0;
+    /* an unmatched close is left for the reader to report; if the index
+     * stops, the rest of the input is not split */
+    while ((p = scan_index_next(&index, p)) && p < end)
     {
-        printf("null");
-    }
-    else
-    {
-        FAIL("cannot render expression %" PRIx64 "\n", exp);
+        if (depth == 0 && (size_t) (p - data) >= target && !is_value_end(*p))
+        {
+            ret = p - data;
+            break;
+        }
+        if (*p == '{' || *p == '[')
+        {
+            depth++;
+        }
+        else if ((*p == '}' || *p == ']') && depth)
+        {
+            depth--;
+        }
+        p++;
     }
+    scan_index_close(&index);
+    return ret;
 }
 
-static void render_symbol(Expr exp)
+static void convert_chunk(char const * data, size_t size, Output * out)
 {
-    ASSERT_DEBUG(is_symbol(exp));
-    emit_str(symbol_name(exp));
+    input_open_memory(&g_in, data, size);
+    g_out = *out;
+    json2sexp();
+    *out = g_out;
+    input_close(&g_in);
 }
 
-static void render_keyword(Expr exp)
+static void convert_input()
 {
-    ASSERT_DEBUG(is_keyword(exp));
-    emit_char(':');
-    emit_str(keyword_name(exp));
+    if (g_num_threads > 1)
+    {
+        parallel_run(&g_in, &g_out, split_values);
+    }
+    else
+    {
+        json2sexp();
+    }
 }
 
-static void render_pair(Expr exp)
+int main(int argc, char ** argv)
 {
-    ASSERT_DEBUG(is_pair(exp));
-    Expr head = car(exp);
-    if (head == intern("object"))
+    scan_init();
+    output_open_fd(&g_out, 1);
+    atexit(flush_output);
+
+    /* options and files can come in any order; what is left in files after
+     * the options are taken out is read in order */
+    char ** files = argv + 1;
+    int num_files = 0;
+    for (int i = 1; i < argc; i++)
     {
-        Expr rest = cdr(exp);
-        if (rest)
+        if (!strcmp(argv[i], "--compact"))
         {
-            emit_str("(object");
-            indent();
-            while (rest)
+            g_compact = true;
+        }
+        else if (!strcmp(argv[i], "--exact-numbers"))
+        {
+            g_exact_numbers = true;
+        }
+        else if (!strcmp(argv[i], "--normalize-numbers"))
+        {
+            g_exact_numbers = false;
+        }
+        else if (!strcmp(argv[i], "--stream"))
+        {
+            g_stream = true;
+        }
+        else if (!strcmp(argv[i], "--select"))
+        {
+            if (++i == argc)
             {
-                emit_char('\n');
-
-                Expr key = car(rest);
-                Expr val = cadr(rest);
-                render_expr(key);
-                emit_str(" ");
-                render_expr(val);
-                rest = cddr(rest);
+                FAIL("--select needs a path\n");
             }
-            emit_str(")");
-            dedent();
+            path_parse(&g_select, argv[i]);
         }
-        else
+        else if (!strcmp(argv[i], "--where"))
         {
-            emit_str("(object)");
+            if (++i == argc)
+            {
+                FAIL("--where needs a test\n");
+            }
+            path_parse_test(&g_where, argv[i]);
         }
-    }
-    else if (head == intern("array"))
-    {
-        Expr rest = cdr(exp);
-        if (rest)
+        else if (!strcmp(argv[i], "-j"))
+        {
+            if (++i == argc)
+            {
+                FAIL("-j needs a number of threads\n");
+            }
+            char * stop;
+            long num = strtol(argv[i], &stop, 10);
+            if (*stop || stop == argv[i] || num < 0 || num > 1024)
+            {
+                FAIL("bad number of threads %s\n", argv[i]);
+            }
+            /* -j 0 uses one thread per cpu */
+            g_num_threads = num ? num : sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        else if (!strcmp(argv[i], "--chunk-size"))
         {
-            emit_str("(array\n");
-            indent();
-            for (Expr iter = rest; iter; iter = cdr(iter))
+            if (++i == argc)
+            {
+                FAIL("--chunk-size needs a number of bytes\n");
+            }
+            char * stop;
+            long long num = strtoll(argv[i], &stop, 10);
+            if (*stop || stop == argv[i] || num < 1)
             {
-                if (is_pair(iter))
-                {
-                    render_expr(car(iter));
-                }
-                else
-                {
-                    FAIL("cannot map dotted list to json\n");
-                    break;
-                }
-                if (cdr(iter))
-                {
-                    emit_str("\n");
-                }
+                FAIL("bad chunk size %s\n", argv[i]);
             }
-            emit_str(")");
-            dedent();
+            g_chunk_size = num;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            FAIL("unknown option %s\n", argv[i]);
         }
         else
         {
-            emit_str("(array)");
+            files[num_files++] = argv[i];
         }
     }
-    else
+
+    if (g_num_threads > 1)
     {
-        FAIL("cannot render pair %016" PRIx64 "\n", exp);
+        parallel_start(g_num_threads, g_chunk_size, convert_chunk);
     }
-}
 
-static void render_string(Expr exp)
-{
-    ASSERT_DEBUG(is_string(exp));
-    char const * str = string_value(exp);
-    emit_char('"');
-    for (char const * p = str; *p; p++)
+    if (num_files == 0)
     {
-        char const ch = *p;
-        switch (ch)
-        {
-        case '\\':
-            emit_char('\\');
-            emit_char('\\');
-            break;
-        case '"':
-            emit_char('\\');
-            emit_char('"');
-            break;
-        default:
-            emit_char(ch);
-            break;
-        }
+        input_open_fd(&g_in, 0);
+        convert_input();
+        input_close(&g_in);
     }
-    emit_char('"');
-}
-
-static void render_expr(Expr exp)
-{
-    switch (expr_type(exp))
+    for (int i = 0; i < num_files; i++)
     {
-    case TYPE_NIL:
-        render_nil(exp);
-        break;
-    case TYPE_SYMBOL:
-        render_symbol(exp);
-        break;
-    case TYPE_KEYWORD:
-        render_keyword(exp);
-        break;
-    case TYPE_PAIR:
-        render_pair(exp);
-        break;
-    case TYPE_STRING:
-        render_string(exp);
-        break;
-    default:
-        FAIL("cannot render expression of type %s\n", expr_type_name(exp));
-        break;
+        if (!strcmp(files[i], "-"))
+        {
+            input_open_fd(&g_in, 0);
+        }
+        else
+        {
+            input_open_file(&g_in, files[i]);
+        }
+        convert_input();
+        input_close(&g_in);
     }
-}
-
-static void json2sexp()
-{
-    Expr exp;
-    while (maybe_read_value(&exp))
+    if (g_num_threads > 1)
     {
-        render_expr(exp);
-        emit_char('\n');
+        parallel_stop();
     }
-}
-
-int main(int argc, char ** argv)
-{
-    json2sexp();
+    output_close(&g_out);
     return 0;
 }
 
 #define LISP_IMPLEMENTATION
 #include "lisp.h"
+
+#define INPUT_IMPLEMENTATION
+#include "input.h"
+
+#define OUTPUT_IMPLEMENTATION
+#include "output.h"
+
+#define PARALLEL_IMPLEMENTATION
+#include "parallel.h"
+
+#define PATH_IMPLEMENTATION
+#include "path.h"
+
+#define SCAN_IMPLEMENTATION
+#include "scan.h"
+
+#define SEXP_IMPLEMENTATION
+#include "sexp.h"
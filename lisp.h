@@ -3,6 +3,7 @@
 #define _LISP_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -20,8 +21,13 @@
 #define ASSERT_DEBUG(x) ((void) x)
 #endif
 
+typedef uint32_t u32;
 typedef uint64_t u64;
 
+/* the heap is private to each thread, so threads can build and drop
+ * values independently without any locking */
+#define THREAD_LOCAL __thread
+
 void fail(char const * file, int line, char const * fmt, ...);
 
 typedef u64 Expr;
@@ -37,6 +43,10 @@ enum
     TYPE_KEYWORD,
     TYPE_PAIR,
     TYPE_STRING,
+    TYPE_SLICE,
+    TYPE_NUMBER,
+    TYPE_BOXED_NUMBER,
+    TYPE_SHORT_STRING,
 };
 
 enum
@@ -57,7 +67,39 @@ inline static bool is_symbol(Expr exp)
 }
 
 Expr make_symbol(char const * name);
+Expr make_symbol_n(char const * name, size_t size);
 char const * symbol_name(Expr exp);
+size_t symbol_size(Expr exp);
+
+/* the well-known symbols are interned before any other, in this order, so
+ * their expressions are constants and the index of one of them is the data
+ * of its expression */
+enum
+{
+    SYMBOL_OBJECT,
+    SYMBOL_ARRAY,
+    SYMBOL_DICT,
+    SYMBOL_LIST,
+    SYMBOL_TRUE,
+    SYMBOL_FALSE,
+    NUM_WELL_KNOWN_SYMBOLS,
+};
+
+#define WELL_KNOWN_SYMBOL(index) (((Expr) (index) << 8) | TYPE_SYMBOL)
+
+#define sym_object WELL_KNOWN_SYMBOL(SYMBOL_OBJECT)
+#define sym_array WELL_KNOWN_SYMBOL(SYMBOL_ARRAY)
+#define sym_dict WELL_KNOWN_SYMBOL(SYMBOL_DICT)
+#define sym_list WELL_KNOWN_SYMBOL(SYMBOL_LIST)
+#define sym_true WELL_KNOWN_SYMBOL(SYMBOL_TRUE)
+#define sym_false WELL_KNOWN_SYMBOL(SYMBOL_FALSE)
+
+/* the index of a well-known symbol, or NUM_WELL_KNOWN_SYMBOLS for any other
+ * expression */
+inline static u64 well_known_symbol(Expr exp)
+{
+    return is_symbol(exp) && (exp >> 8) < NUM_WELL_KNOWN_SYMBOLS ? exp >> 8 : NUM_WELL_KNOWN_SYMBOLS;
+}
 
 inline static bool is_keyword(Expr exp)
 {
@@ -65,7 +107,9 @@ inline static bool is_keyword(Expr exp)
 }
 
 Expr make_keyword(char const * name);
+Expr make_keyword_n(char const * name, size_t size);
 char const * keyword_name(Expr exp);
+size_t keyword_size(Expr exp);
 
 inline static bool is_pair(Expr exp)
 {
@@ -79,15 +123,75 @@ Expr pair_second(Expr exp);
 void pair_set_first(Expr exp, Expr val);
 void pair_set_second(Expr exp, Expr val);
 
+/* a slice is a string that refers to its bytes in the source set with
+ * string_set_source instead of owning a copy; the source must outlive it.
+ * a string of fewer than STRING_SHORT_SIZE bytes, none of them nul, is
+ * short and is kept in the data of the expression itself rather than
+ * copied, unless it can be a slice. */
 inline static bool is_string(Expr exp)
 {
-    return expr_type(exp) == TYPE_STRING;
+    return expr_type(exp) == TYPE_STRING || expr_type(exp) == TYPE_SLICE ||
+        expr_type(exp) == TYPE_SHORT_STRING;
 }
 
+#define STRING_SHORT_SIZE 8
+
 Expr make_string(char const * val);
-char const * string_value(Expr exp);
+Expr make_string_n(char const * val, size_t size);
+Expr make_string_slice(char const * val, size_t size);
+void string_set_source(char const * base, size_t size);
+
+/* string_value points at string_size bytes, which are only followed by a
+ * nul if the string is not a slice. the bytes of a short string are copied
+ * to the STRING_SHORT_SIZE bytes at buffer, which is what it then points
+ * at. */
+char const * string_value(Expr exp, char * buffer);
+size_t string_size(Expr exp);
+
+/* builds a string in place, one piece at a time; only one string can be
+ * under construction at once */
+void string_begin();
+void string_push(char ch);
+void string_append(char const * data, size_t size);
+Expr string_end();
+
+/* an integer that fits in the 56 bits of data of an expression is kept in
+ * it. any other number is boxed in the string arena, as an integer or as a
+ * double, along with the text it was read from when that has to be kept;
+ * the boxed numbers go when the heap is rewound past them. */
+inline static bool is_number(Expr exp)
+{
+    return expr_type(exp) == TYPE_NUMBER || expr_type(exp) == TYPE_BOXED_NUMBER;
+}
+
+Expr make_integer(int64_t val);
+Expr make_double(double val);
+
+/* number_integer is only for integers; every number has a double value */
+bool number_is_integer(Expr exp);
+int64_t number_integer(Expr exp);
+double number_double(Expr exp);
+
+/* reads a number in json syntax from the size bytes at text, returns false
+ * if they are not one. with exact, the text is kept with the number unless
+ * number_text gives it back as it is, which is only tried for doubles of up
+ * to 15 significant digits; it is always kept for a number that is too
+ * large for a double. */
+bool parse_number(char const * text, size_t size, bool exact, Expr * pexp);
+
+/* the text a number was read from if it was kept, or NULL */
+char const * number_lexeme(Expr exp, size_t * psize);
+
+#define NUMBER_TEXT_SIZE 32
+
+/* the text of a number: the text it was read from if that was kept, or the
+ * shortest text that reads back as the same number, which is written to
+ * the NUMBER_TEXT_SIZE bytes at buffer. a double always has a '.' or an
+ * exponent in its text, so it reads back as a double. */
+char const * number_text(Expr exp, char * buffer, size_t * psize);
 
 Expr intern(char const * name);
+Expr intern_n(char const * name, size_t size);
 
 Expr cons(Expr a, Expr b);
 Expr car(Expr exp);
@@ -106,6 +210,46 @@ inline static Expr cddr(Expr exp)
     return cdr(cdr(exp));
 }
 
+/* an object is a list (object :k1 v1 :k2 v2 ...) of keys and values. a
+ * lookup walks the list while the object is small; past that, the first
+ * lookup builds a hash index of the object that is kept for the ones after
+ * it, until the heap is rewound past the object. an object must not gain
+ * or lose members once it has been looked up in, but its values can be
+ * changed. */
+
+/* the member of obj that starts with key, so that the value is its cadr,
+ * or nil if there is none; the first one wins if key occurs more than once */
+Expr object_find(Expr obj, Expr key);
+
+/* the value of key in obj, or nil if there is none */
+inline static Expr object_get(Expr obj, Expr key)
+{
+    return cadr(object_find(obj, key));
+}
+
+/* a key that occurs more than once in obj, or nil if every key is unique */
+Expr object_duplicate_key(Expr obj);
+
+/* a heap mark records how much of each store is in use; rewinding to it
+ * drops every pair, string, symbol and keyword created since the mark */
+typedef struct
+{
+    u64 pairs;
+    u64 symbols;
+    u64 keywords;
+    u64 name_chunks;
+    u64 name_used;
+    u64 string_chunks;
+    u64 string_used;
+} HeapMark;
+
+HeapMark heap_mark();
+void heap_rewind(HeapMark mark);
+
+/* moves the symbols and keywords of mark up to the ones that exist now, so
+ * that rewinding to it only drops pairs and strings */
+void heap_keep_names(HeapMark * mark);
+
 #endif /* _LISP_H_ */
 
 #ifdef LISP_IMPLEMENTATION
@@ -113,6 +257,8 @@ inline static Expr cddr(Expr exp)
 #ifndef _LISP_C_
 #define _LISP_C_
 
+#include <float.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -145,76 +291,299 @@ u64 expr_data(Expr exp)
     return exp >> 8;
 }
 
-#define MAX_SYMBOLS 100
+typedef struct
+{
+    char ** chunks;
+    u64 * sizes;
+    u64 num_chunks;
+    u64 max_chunks;
+    u64 used;
+    char * spare; /* a chunk of the default size kept back by a rewind */
+} Arena;
 
-static char * g_symbol_names[MAX_SYMBOLS];
-static u64 g_symbol_count = 0;
+#define ARENA_CHUNK_SIZE ((u64) 1 << 20)
 
-Expr make_symbol(char const * name)
+static void _arena_add_chunk(Arena * arena, u64 min_size)
 {
-    u64 index;
-    for (index = 0; index < g_symbol_count; index++)
+    if (arena->num_chunks == arena->max_chunks)
     {
-        if (!strcmp(g_symbol_names[index], name))
+        arena->max_chunks = arena->max_chunks ? 2 * arena->max_chunks : 16;
+        arena->chunks = (char **) realloc(arena->chunks, arena->max_chunks * sizeof(char *));
+        arena->sizes = (u64 *) realloc(arena->sizes, arena->max_chunks * sizeof(u64));
+        ASSERT(arena->chunks && arena->sizes);
+    }
+    u64 const size = min_size > ARENA_CHUNK_SIZE ? min_size : ARENA_CHUNK_SIZE;
+    char * chunk = arena->spare;
+    if (chunk && size == ARENA_CHUNK_SIZE)
+    {
+        arena->spare = NULL;
+    }
+    else
+    {
+        chunk = (char *) malloc(size);
+        ASSERT(chunk);
+    }
+    arena->chunks[arena->num_chunks] = chunk;
+    arena->sizes[arena->num_chunks] = size;
+    arena->num_chunks++;
+    arena->used = 0;
+}
+
+static char * _arena_alloc(Arena * arena, u64 size)
+{
+    if (!arena->num_chunks || arena->used + size > arena->sizes[arena->num_chunks - 1])
+    {
+        _arena_add_chunk(arena, size);
+    }
+    char * ptr = arena->chunks[arena->num_chunks - 1] + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+static void _arena_rewind(Arena * arena, u64 num_chunks, u64 used)
+{
+    ASSERT(num_chunks <= arena->num_chunks);
+    while (arena->num_chunks > num_chunks)
+    {
+        arena->num_chunks--;
+        char * chunk = arena->chunks[arena->num_chunks];
+        if (!arena->spare && arena->sizes[arena->num_chunks] == ARENA_CHUNK_SIZE)
         {
-            break;
+            arena->spare = chunk;
+        }
+        else
+        {
+            free(chunk);
         }
     }
+    arena->used = num_chunks ? used : 0;
+}
 
-    if (index == g_symbol_count)
+static u64 _hash_mix(u64 h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static u64 _hash_bytes(char const * data, u64 size)
+{
+    u64 h = 0x9e3779b97f4a7c15ull ^ size;
+    while (size >= 8)
     {
-        ASSERT(g_symbol_count < MAX_SYMBOLS);
-        size_t len = strlen(name);
-        char * copy = (char *) malloc(len + 1);
-        memcpy(copy, name, len + 1);
-        g_symbol_names[g_symbol_count++] = copy;
+        u64 k;
+        memcpy(&k, data, 8);
+        h = (h ^ _hash_mix(k)) * 0x100000001b3ull;
+        data += 8;
+        size -= 8;
     }
+    if (size)
+    {
+        u64 k = 0;
+        memcpy(&k, data, size);
+        h = (h ^ _hash_mix(k)) * 0x100000001b3ull;
+    }
+    return _hash_mix(h);
+}
+
+/* names are kept dense in order of creation, so the index of a name is the
+ * data of its expression; the open addressing slots map hashes to indices */
+
+typedef struct
+{
+    char const * name;
+    u64 size;
+    u64 hash;
+} Name;
 
-    return make_expr(TYPE_SYMBOL, index);
+typedef struct
+{
+    u32 hash;
+    u32 index; /* index + 1, 0 marks an empty slot */
+} NameSlot;
+
+typedef struct
+{
+    Name * names;
+    u64 count;
+    u64 capacity;
+    NameSlot * slots;
+    u64 mask;
+} NameTable;
+
+static THREAD_LOCAL Arena g_name_arena;
+
+static void _name_table_insert_slot(NameTable * table, u64 hash, u64 index)
+{
+    u64 pos = hash & table->mask;
+    while (table->slots[pos].index)
+    {
+        pos = (pos + 1) & table->mask;
+    }
+    table->slots[pos].hash = (u32) (hash >> 32);
+    table->slots[pos].index = (u32) (index + 1);
 }
 
-char const * symbol_name(Expr exp)
+static void _name_table_grow(NameTable * table)
 {
-    ASSERT(is_symbol(exp));
-    u64 const index = expr_data(exp);
-    ASSERT(index < g_symbol_count);
-    return g_symbol_names[index];
+    u64 const num_slots = table->slots ? 2 * (table->mask + 1) : 256;
+    free(table->slots);
+    table->slots = (NameSlot *) calloc(num_slots, sizeof(NameSlot));
+    ASSERT(table->slots);
+    table->mask = num_slots - 1;
+    for (u64 index = 0; index < table->count; index++)
+    {
+        _name_table_insert_slot(table, table->names[index].hash, index);
+    }
 }
 
-#define MAX_KEYWORDS 100
+static u64 _name_table_intern(NameTable * table, char const * name, u64 size)
+{
+    u64 const hash = _hash_bytes(name, size);
+    if (table->slots)
+    {
+        u32 const tag = (u32) (hash >> 32);
+        for (u64 pos = hash & table->mask; table->slots[pos].index; pos = (pos + 1) & table->mask)
+        {
+            NameSlot const slot = table->slots[pos];
+            if (slot.hash == tag)
+            {
+                Name const * entry = &table->names[slot.index - 1];
+                if (entry->size == size && !memcmp(entry->name, name, size))
+                {
+                    return slot.index - 1;
+                }
+            }
+        }
+    }
 
-static char * g_keyword_names[MAX_KEYWORDS];
-static u64 g_keyword_count = 0;
+    ASSERT(table->count < UINT32_MAX);
+    if (!table->slots || 2 * (table->count + 1) > table->mask + 1)
+    {
+        _name_table_grow(table);
+    }
+    if (table->count == table->capacity)
+    {
+        table->capacity = table->capacity ? 2 * table->capacity : 256;
+        table->names = (Name *) realloc(table->names, table->capacity * sizeof(Name));
+        ASSERT(table->names);
+    }
 
-Expr make_keyword(char const * name)
+    char * copy = _arena_alloc(&g_name_arena, size + 1);
+    memcpy(copy, name, size);
+    copy[size] = '\0';
+
+    u64 const index = table->count++;
+    table->names[index].name = copy;
+    table->names[index].size = size;
+    table->names[index].hash = hash;
+    _name_table_insert_slot(table, hash, index);
+    return index;
+}
+
+static void _name_table_rewind(NameTable * table, u64 count)
 {
-    u64 index;
-    for (index = 0; index < g_keyword_count; index++)
+    ASSERT(count <= table->count);
+    /* names are dropped newest first; every probe sequence of an older name
+     * only passes through slots of names older still, so clearing slots is
+     * enough and no tombstones are needed */
+    while (table->count > count)
     {
-        if (!strcmp(g_keyword_names[index], name))
+        u64 const index = --table->count;
+        u64 pos = table->names[index].hash & table->mask;
+        while (table->slots[pos].index != index + 1)
         {
-            break;
+            pos = (pos + 1) & table->mask;
         }
+        table->slots[pos].hash = 0;
+        table->slots[pos].index = 0;
     }
+}
 
-    if (index == g_keyword_count)
+static THREAD_LOCAL NameTable g_symbols;
+
+static char const * const g_well_known_symbols[NUM_WELL_KNOWN_SYMBOLS] =
+{
+    "object",
+    "array",
+    "dict",
+    "list",
+    "true",
+    "false",
+};
+
+/* the symbol table of the thread, with the well-known symbols in it */
+static NameTable * _symbol_table()
+{
+    if (!g_symbols.count)
     {
-        ASSERT(g_keyword_count < MAX_KEYWORDS);
-        size_t len = strlen(name);
-        char * copy = (char *) malloc(len + 1);
-        memcpy(copy, name, len + 1);
-        g_keyword_names[g_keyword_count++] = copy;
+        for (u64 index = 0; index < NUM_WELL_KNOWN_SYMBOLS; index++)
+        {
+            char const * name = g_well_known_symbols[index];
+            u64 const got = _name_table_intern(&g_symbols, name, strlen(name));
+            ASSERT(got == index);
+        }
     }
+    return &g_symbols;
+}
+
+Expr make_symbol(char const * name)
+{
+    return make_symbol_n(name, strlen(name));
+}
+
+Expr make_symbol_n(char const * name, size_t size)
+{
+    return make_expr(TYPE_SYMBOL, _name_table_intern(_symbol_table(), name, size));
+}
+
+char const * symbol_name(Expr exp)
+{
+    ASSERT(is_symbol(exp));
+    u64 const index = expr_data(exp);
+    NameTable const * table = _symbol_table();
+    ASSERT(index < table->count);
+    return table->names[index].name;
+}
+
+size_t symbol_size(Expr exp)
+{
+    ASSERT(is_symbol(exp));
+    u64 const index = expr_data(exp);
+    NameTable const * table = _symbol_table();
+    ASSERT(index < table->count);
+    return table->names[index].size;
+}
+
+static THREAD_LOCAL NameTable g_keywords;
+
+Expr make_keyword(char const * name)
+{
+    return make_keyword_n(name, strlen(name));
+}
 
-    return make_expr(TYPE_KEYWORD, index);
+Expr make_keyword_n(char const * name, size_t size)
+{
+    return make_expr(TYPE_KEYWORD, _name_table_intern(&g_keywords, name, size));
 }
 
 char const * keyword_name(Expr exp)
 {
     ASSERT(is_keyword(exp));
     u64 const index = expr_data(exp);
-    ASSERT(index < g_keyword_count);
-    return g_keyword_names[index];
+    ASSERT(index < g_keywords.count);
+    return g_keywords.names[index].name;
+}
+
+size_t keyword_size(Expr exp)
+{
+    ASSERT(is_keyword(exp));
+    u64 const index = expr_data(exp);
+    ASSERT(index < g_keywords.count);
+    return g_keywords.names[index].size;
 }
 
 typedef struct
@@ -222,17 +591,51 @@ typedef struct
     Expr first, second;
 } Pair;
 
-#define MAX_PAIRS 1000
+/* pairs live in fixed-size chunks that are never moved, so the index stored
+ * in a pair expression stays valid as the store grows */
+
+#define PAIR_CHUNK_BITS 20
+#define PAIR_CHUNK_SIZE ((u64) 1 << PAIR_CHUNK_BITS)
+#define PAIR_CHUNK_MASK (PAIR_CHUNK_SIZE - 1)
 
-Pair g_pairs[MAX_PAIRS];
-u64 g_num_pairs = 0;
+static THREAD_LOCAL Pair ** g_pair_chunks;
+static THREAD_LOCAL u64 g_num_pair_chunks = 0;
+static THREAD_LOCAL u64 g_max_pair_chunks = 0;
+
+static THREAD_LOCAL Pair * g_pair_next;
+static THREAD_LOCAL Pair * g_pair_end;
+THREAD_LOCAL u64 g_num_pairs = 0;
+
+static void _pair_next_chunk()
+{
+    u64 const chunk = g_num_pairs >> PAIR_CHUNK_BITS;
+    ASSERT(chunk <= g_num_pair_chunks);
+    if (chunk == g_num_pair_chunks)
+    {
+        if (g_num_pair_chunks == g_max_pair_chunks)
+        {
+            g_max_pair_chunks = g_max_pair_chunks ? 2 * g_max_pair_chunks : 64;
+            g_pair_chunks = (Pair **) realloc(g_pair_chunks, g_max_pair_chunks * sizeof(Pair *));
+            ASSERT(g_pair_chunks);
+        }
+        g_pair_chunks[g_num_pair_chunks] = (Pair *) malloc(PAIR_CHUNK_SIZE * sizeof(Pair));
+        ASSERT(g_pair_chunks[g_num_pair_chunks]);
+        g_num_pair_chunks++;
+    }
+    g_pair_next = g_pair_chunks[chunk];
+    g_pair_end = g_pair_next + PAIR_CHUNK_SIZE;
+}
 
 Expr make_pair(Expr a, Expr b)
 {
-    ASSERT(g_num_pairs < MAX_PAIRS);
+    if (g_pair_next == g_pair_end)
+    {
+        _pair_next_chunk();
+    }
     u64 const index = g_num_pairs++;
-    g_pairs[index].first = a;
-    g_pairs[index].second = b;
+    Pair * pair = g_pair_next++;
+    pair->first = a;
+    pair->second = b;
     return make_expr(TYPE_PAIR, index);
 }
 
@@ -244,64 +647,725 @@ static u64 _pair_index(Expr exp)
     return index;
 }
 
+static Pair * _pair(Expr exp)
+{
+    u64 const index = _pair_index(exp);
+    return &g_pair_chunks[index >> PAIR_CHUNK_BITS][index & PAIR_CHUNK_MASK];
+}
+
 Expr pair_first(Expr exp)
 {
-    return g_pairs[_pair_index(exp)].first;
+    return _pair(exp)->first;
 }
 
 Expr pair_second(Expr exp)
 {
-    return g_pairs[_pair_index(exp)].second;
+    return _pair(exp)->second;
 }
 
 void pair_set_first(Expr exp, Expr val)
 {
-    g_pairs[_pair_index(exp)].first = val;
+    _pair(exp)->first = val;
 }
 
 void pair_set_second(Expr exp, Expr val)
 {
-    g_pairs[_pair_index(exp)].second = val;
+    _pair(exp)->second = val;
 }
 
-#define MAX_STRINGS 100
+/* strings are stored back to back in an arena as a length header followed
+ * by the bytes and a terminating nul; a string expression holds the chunk
+ * and offset of the header */
+
+#define STRING_OFFSET_BITS 36
+#define STRING_OFFSET_MASK (((u64) 1 << STRING_OFFSET_BITS) - 1)
 
-char * g_strings[MAX_STRINGS];
-u64 g_num_strings = 0;
+static THREAD_LOCAL Arena g_string_arena;
+
+static THREAD_LOCAL u64 g_string_start;
+static THREAD_LOCAL char * g_string_out;
+static THREAD_LOCAL char * g_string_limit;
+static THREAD_LOCAL bool g_string_open = false;
+
+static char * _string_chunk()
+{
+    return g_string_arena.chunks[g_string_arena.num_chunks - 1];
+}
+
+/* moves the open string to a chunk with room for size more bytes */
+static void _string_grow(size_t size)
+{
+    char * const header = _string_chunk() + g_string_start;
+    u64 const used = g_string_out - header;
+    _arena_add_chunk(&g_string_arena, 2 * (used + size + 1));
+    char * const chunk = _string_chunk();
+    memcpy(chunk, header, used);
+    g_string_start = 0;
+    g_string_out = chunk + used;
+    g_string_limit = chunk + g_string_arena.sizes[g_string_arena.num_chunks - 1] - 1;
+}
+
+void string_begin()
+{
+    ASSERT(!g_string_open);
+    g_string_open = true;
+    if (!g_string_arena.num_chunks ||
+        g_string_arena.used + sizeof(u64) + 1 > g_string_arena.sizes[g_string_arena.num_chunks - 1])
+    {
+        _arena_add_chunk(&g_string_arena, sizeof(u64) + 1);
+    }
+    char * const chunk = _string_chunk();
+    g_string_start = g_string_arena.used;
+    g_string_out = chunk + g_string_start + sizeof(u64);
+    g_string_limit = chunk + g_string_arena.sizes[g_string_arena.num_chunks - 1] - 1;
+}
+
+void string_push(char ch)
+{
+    ASSERT_DEBUG(g_string_open);
+    if (g_string_out == g_string_limit)
+    {
+        _string_grow(1);
+    }
+    *g_string_out++ = ch;
+}
+
+void string_append(char const * data, size_t size)
+{
+    ASSERT_DEBUG(g_string_open);
+    if ((size_t) (g_string_limit - g_string_out) < size)
+    {
+        _string_grow(size);
+    }
+    memcpy(g_string_out, data, size);
+    g_string_out += size;
+}
+
+/* the bytes of a short string, first byte lowest, with no nul among
+ * them, so that its size is where the nonzero bytes end */
+
+static bool _string_is_short(char const * val, size_t size)
+{
+    return size < STRING_SHORT_SIZE && !memchr(val, '\0', size);
+}
+
+static Expr _make_short_string(char const * val, size_t size)
+{
+    u64 data = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        data |= (u64) (unsigned char) val[i] << (8 * i);
+    }
+    return make_expr(TYPE_SHORT_STRING, data);
+}
+
+Expr string_end()
+{
+    ASSERT(g_string_open);
+    g_string_open = false;
+    char * const chunk = _string_chunk();
+    char * const header = chunk + g_string_start;
+    u64 const size = g_string_out - (header + sizeof(u64));
+    if (_string_is_short(header + sizeof(u64), size))
+    {
+        /* the arena is left as it was before string_begin */
+        return _make_short_string(header + sizeof(u64), size);
+    }
+    memcpy(header, &size, sizeof(u64));
+    *g_string_out++ = '\0';
+    g_string_arena.used = g_string_out - chunk;
+
+    u64 const chunk_index = g_string_arena.num_chunks - 1;
+    ASSERT(g_string_start <= STRING_OFFSET_MASK);
+    ASSERT(chunk_index < ((u64) 1 << (56 - STRING_OFFSET_BITS)));
+    return make_expr(TYPE_STRING, (chunk_index << STRING_OFFSET_BITS) | g_string_start);
+}
 
 Expr make_string(char const * val)
 {
-    ASSERT(g_num_strings < MAX_STRINGS);
-    size_t len = strlen(val);
-    char * str = (char *) malloc(len + 1);
-    memcpy(str, val, len + 1);
-    u64 const index = g_num_strings++;
-    g_strings[index] = str;
-    return make_expr(TYPE_STRING, index);
+    return make_string_n(val, strlen(val));
+}
+
+Expr make_string_n(char const * val, size_t size)
+{
+    if (_string_is_short(val, size))
+    {
+        return _make_short_string(val, size);
+    }
+    string_begin();
+    string_append(val, size);
+    return string_end();
+}
+
+static char const * _string_header(Expr exp)
+{
+    ASSERT_DEBUG(expr_type(exp) == TYPE_STRING || expr_type(exp) == TYPE_BOXED_NUMBER);
+    u64 const data = expr_data(exp);
+    u64 const chunk = data >> STRING_OFFSET_BITS;
+    ASSERT(chunk < g_string_arena.num_chunks);
+    return g_string_arena.chunks[chunk] + (data & STRING_OFFSET_MASK);
+}
+
+/* a slice packs the offset into the source above its size */
+
+#define SLICE_SIZE_BITS 20
+#define SLICE_SIZE_MASK (((u64) 1 << SLICE_SIZE_BITS) - 1)
+#define SLICE_OFFSET_LIMIT ((u64) 1 << (56 - SLICE_SIZE_BITS))
+
+static THREAD_LOCAL char const * g_source = NULL;
+static THREAD_LOCAL u64 g_source_size = 0;
+
+void string_set_source(char const * base, size_t size)
+{
+    g_source = base;
+    g_source_size = size;
 }
 
-char const * string_value(Expr exp)
+Expr make_string_slice(char const * val, size_t size)
 {
+    /* without a source, as on stdin or a worker thread, there is nothing
+     * to take an offset from */
+    if (g_source && val >= g_source)
+    {
+        u64 const offset = val - g_source;
+        if (offset + size <= g_source_size && offset < SLICE_OFFSET_LIMIT && size <= SLICE_SIZE_MASK)
+        {
+            return make_expr(TYPE_SLICE, (offset << SLICE_SIZE_BITS) | size);
+        }
+    }
+    return make_string_n(val, size);
+}
+
+char const * string_value(Expr exp, char * buffer)
+{
+    if (expr_type(exp) == TYPE_SHORT_STRING)
+    {
+        u64 const data = expr_data(exp);
+        for (size_t i = 0; i < STRING_SHORT_SIZE; i++)
+        {
+            buffer[i] = (char) (data >> (8 * i));
+        }
+        return buffer;
+    }
+    if (expr_type(exp) == TYPE_SLICE)
+    {
+        return g_source + (expr_data(exp) >> SLICE_SIZE_BITS);
+    }
     ASSERT(is_string(exp));
-    u64 const index = expr_data(exp);
-    ASSERT(index < g_num_strings);
-    return g_strings[index];
+    return _string_header(exp) + sizeof(u64);
+}
+
+size_t string_size(Expr exp)
+{
+    if (expr_type(exp) == TYPE_SHORT_STRING)
+    {
+        u64 const data = expr_data(exp);
+        return data ? (size_t) (71 - __builtin_clzll(data)) / 8 : 0;
+    }
+    if (expr_type(exp) == TYPE_SLICE)
+    {
+        return expr_data(exp) & SLICE_SIZE_MASK;
+    }
+    ASSERT(is_string(exp));
+    u64 size;
+    memcpy(&size, _string_header(exp), sizeof(u64));
+    return size;
+}
+
+/* a boxed number is a string of the kind of number, its value and the text
+ * it was read from, if any, that is tagged as a number */
+
+enum
+{
+    NUMBER_BOX_INTEGER,
+    NUMBER_BOX_DOUBLE,
+};
+
+#define NUMBER_BOX_SIZE (2 * sizeof(u64))
+#define NUMBER_IMMEDIATE_BITS 56
+
+static Expr _number_box(u64 kind, u64 bits, char const * text, size_t size)
+{
+    string_begin();
+    string_append((char const *) &kind, sizeof(u64));
+    string_append((char const *) &bits, sizeof(u64));
+    if (size)
+    {
+        string_append(text, size);
+    }
+    return make_expr(TYPE_BOXED_NUMBER, expr_data(string_end()));
+}
+
+/* the header of the string that boxes exp */
+static char const * _number_unbox(Expr exp, u64 * kind, u64 * bits)
+{
+    ASSERT(expr_type(exp) == TYPE_BOXED_NUMBER);
+    char const * const header = _string_header(exp);
+    memcpy(kind, header + sizeof(u64), sizeof(u64));
+    memcpy(bits, header + 2 * sizeof(u64), sizeof(u64));
+    return header;
+}
+
+static bool _number_is_immediate(int64_t val)
+{
+    int64_t const limit = (int64_t) 1 << (NUMBER_IMMEDIATE_BITS - 1);
+    return val >= -limit && val < limit;
+}
+
+static Expr _make_integer(int64_t val, char const * text, size_t size)
+{
+    if (_number_is_immediate(val) && !size)
+    {
+        return make_expr(TYPE_NUMBER, (u64) val & (((u64) 1 << NUMBER_IMMEDIATE_BITS) - 1));
+    }
+    return _number_box(NUMBER_BOX_INTEGER, (u64) val, text, size);
+}
+
+static Expr _make_double(double val, char const * text, size_t size)
+{
+    u64 bits;
+    memcpy(&bits, &val, sizeof(u64));
+    return _number_box(NUMBER_BOX_DOUBLE, bits, text, size);
+}
+
+Expr make_integer(int64_t val)
+{
+    return _make_integer(val, NULL, 0);
+}
+
+Expr make_double(double val)
+{
+    return _make_double(val, NULL, 0);
+}
+
+bool number_is_integer(Expr exp)
+{
+    ASSERT(is_number(exp));
+    if (expr_type(exp) == TYPE_NUMBER)
+    {
+        return true;
+    }
+    u64 kind, bits;
+    _number_unbox(exp, &kind, &bits);
+    return kind == NUMBER_BOX_INTEGER;
+}
+
+int64_t number_integer(Expr exp)
+{
+    if (expr_type(exp) == TYPE_NUMBER)
+    {
+        /* the data is sign extended by shifting the whole expression */
+        return (int64_t) exp >> 8;
+    }
+    u64 kind, bits;
+    _number_unbox(exp, &kind, &bits);
+    ASSERT(kind == NUMBER_BOX_INTEGER);
+    return (int64_t) bits;
+}
+
+double number_double(Expr exp)
+{
+    if (expr_type(exp) == TYPE_NUMBER)
+    {
+        return (double) number_integer(exp);
+    }
+    u64 kind, bits;
+    _number_unbox(exp, &kind, &bits);
+    if (kind == NUMBER_BOX_INTEGER)
+    {
+        return (double) (int64_t) bits;
+    }
+    double val;
+    memcpy(&val, &bits, sizeof(double));
+    return val;
+}
+
+static size_t _format_integer(int64_t val, char * buffer)
+{
+    char digits[24];
+    char * p = digits + sizeof(digits);
+    u64 mag = val < 0 ? -(u64) val : (u64) val;
+    do
+    {
+        *--p = '0' + mag % 10;
+        mag /= 10;
+    }
+    while (mag);
+    if (val < 0)
+    {
+        *--p = '-';
+    }
+    size_t const size = digits + sizeof(digits) - p;
+    memcpy(buffer, p, size);
+    return size;
+}
+
+/* the powers of ten that are exact in a double */
+static double const g_exact_powers_of_ten[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define NUMBER_MAX_EXACT_POWER 22
+#define NUMBER_MAX_EXACT_MANTISSA ((u64) 1 << 53)
+
+/* writes val as %.15g would, without going through printf, when 15 digits
+ * read back as val, which is then shown by scaling the digits back with an
+ * exact power of ten. no two texts of up to 15 digits give the same double,
+ * so these are also the shortest. returns 0 if val has to be written with
+ * printf, and lowers *precision to 16 when it is certain that 15 digits are
+ * not enough. */
+static size_t _format_double_short(double val, char * buffer, int * precision)
+{
+    char * p = buffer;
+    if (!isfinite(val))
+    {
+        return 0;
+    }
+    if (signbit(val))
+    {
+        *p++ = '-';
+        val = -val;
+    }
+    if (val == 0)
+    {
+        memcpy(p, "0.0", 4);
+        return p + 3 - buffer;
+    }
+    /* 78913 / 2^18 is close enough to log10(2) that this is the decimal
+     * exponent of val or one less, which shows in a mantissa that is too
+     * large */
+    u64 bits;
+    memcpy(&bits, &val, sizeof(u64));
+    int exponent = (((int) (bits >> 52) - 1023) * 78913) >> 18;
+    int scale;
+    u64 mantissa;
+    for (int tries = 0; ; tries++)
+    {
+        scale = 14 - exponent;
+        if (scale < -NUMBER_MAX_EXACT_POWER || scale > NUMBER_MAX_EXACT_POWER)
+        {
+            return 0;
+        }
+        double const scaled = scale < 0 ? val / g_exact_powers_of_ten[-scale] : val * g_exact_powers_of_ten[scale];
+        mantissa = (u64) (scaled + 0.5);
+        if (mantissa < (u64) 1e15)
+        {
+            break;
+        }
+        if (tries)
+        {
+            return 0;
+        }
+        exponent++;
+    }
+    if (mantissa < (u64) 1e14)
+    {
+        return 0;
+    }
+    double const back = scale < 0 ? (double) mantissa * g_exact_powers_of_ten[-scale] : (double) mantissa / g_exact_powers_of_ten[scale];
+    if (back != val)
+    {
+        *precision = 16;
+        return 0;
+    }
+
+    char digits[15];
+    u64 rest = mantissa;
+    for (int i = 14; i >= 0; i--)
+    {
+        digits[i] = '0' + rest % 10;
+        rest /= 10;
+    }
+    int num_digits = 15;
+    while (digits[num_digits - 1] == '0')
+    {
+        num_digits--;
+    }
+
+    if (exponent < -4 || exponent >= 15)
+    {
+        *p++ = digits[0];
+        if (num_digits > 1)
+        {
+            *p++ = '.';
+            memcpy(p, digits + 1, num_digits - 1);
+            p += num_digits - 1;
+        }
+        *p++ = 'e';
+        if (exponent < 0)
+        {
+            *p++ = '-';
+        }
+        p += _format_integer(exponent < 0 ? -exponent : exponent, p);
+    }
+    else if (exponent < 0)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -exponent - 1);
+        p += -exponent - 1;
+        memcpy(p, digits, num_digits);
+        p += num_digits;
+    }
+    else
+    {
+        int const whole = exponent + 1;
+        int const from_digits = num_digits < whole ? num_digits : whole;
+        memcpy(p, digits, from_digits);
+        memset(p + from_digits, '0', whole - from_digits);
+        p += whole;
+        *p++ = '.';
+        if (num_digits > whole)
+        {
+            memcpy(p, digits + whole, num_digits - whole);
+            p += num_digits - whole;
+        }
+        else
+        {
+            *p++ = '0';
+        }
+    }
+    *p = '\0';
+    return p - buffer;
+}
+
+/* the shortest text with up to 17 significant digits that reads back as
+ * val. when 15 digits do, %g has dropped the trailing zeros of any shorter
+ * text that does too, so only subnormals, which have fewer digits, need
+ * the precisions below that tried. the exponent loses its plus sign and
+ * leading zeros. */
+static size_t _format_double(double val, char * buffer)
+{
+    int precision = fabs(val) < DBL_MIN ? 1 : 15;
+    size_t const short_size = _format_double_short(val, buffer, &precision);
+    if (short_size)
+    {
+        return short_size;
+    }
+    int size = 0;
+    for (; precision <= 17; precision++)
+    {
+        size = snprintf(buffer, NUMBER_TEXT_SIZE, "%.*g", precision, val);
+        if (strtod(buffer, NULL) == val)
+        {
+            break;
+        }
+    }
+    char * e = strchr(buffer, 'e');
+    if (e)
+    {
+        char * to = e + 1 + (e[1] == '-');
+        char * first = e + 1 + (e[1] == '-' || e[1] == '+');
+        while (*first == '0' && first[1])
+        {
+            first++;
+        }
+        memmove(to, first, buffer + size + 1 - first);
+        size -= first - to;
+    }
+    else if (!strpbrk(buffer, ".n"))
+    {
+        buffer[size++] = '.';
+        buffer[size++] = '0';
+        buffer[size] = '\0';
+    }
+    return size;
+}
+
+char const * number_lexeme(Expr exp, size_t * psize)
+{
+    if (expr_type(exp) == TYPE_NUMBER)
+    {
+        return NULL;
+    }
+    u64 kind, bits;
+    char const * const header = _number_unbox(exp, &kind, &bits);
+    u64 size;
+    memcpy(&size, header, sizeof(u64));
+    if (size == NUMBER_BOX_SIZE)
+    {
+        return NULL;
+    }
+    *psize = size - NUMBER_BOX_SIZE;
+    return header + sizeof(u64) + NUMBER_BOX_SIZE;
+}
+
+char const * number_text(Expr exp, char * buffer, size_t * psize)
+{
+    if (expr_type(exp) == TYPE_NUMBER)
+    {
+        *psize = _format_integer(number_integer(exp), buffer);
+        return buffer;
+    }
+    char const * const lexeme = number_lexeme(exp, psize);
+    if (lexeme)
+    {
+        return lexeme;
+    }
+    u64 kind, bits;
+    _number_unbox(exp, &kind, &bits);
+    if (kind == NUMBER_BOX_INTEGER)
+    {
+        *psize = _format_integer((int64_t) bits, buffer);
+    }
+    else
+    {
+        double val;
+        memcpy(&val, &bits, sizeof(double));
+        *psize = _format_double(val, buffer);
+    }
+    return buffer;
+}
+
+bool parse_number(char const * text, size_t size, bool exact, Expr * pexp)
+{
+    char const * p = text;
+    char const * const end = text + size;
+    bool const negative = p < end && *p == '-';
+    p += negative;
+
+    /* the digits are gathered into a mantissa for as long as it is exact,
+     * the others only move the decimal point */
+    u64 mantissa = 0;
+    int num_digits = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+    if (p == end || *p < '0' || *p > '9' || (*p == '0' && p + 1 < end && p[1] >= '0' && p[1] <= '9'))
+    {
+        return false;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (num_digits < 19)
+        {
+            mantissa = 10 * mantissa + (*p - '0');
+            num_digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+            truncated = true;
+        }
+    }
+    bool integer = true;
+    if (p < end && *p == '.')
+    {
+        integer = false;
+        if (++p == end || *p < '0' || *p > '9')
+        {
+            return false;
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (num_digits < 19)
+            {
+                mantissa = 10 * mantissa + (*p - '0');
+                num_digits += mantissa != 0;
+                exponent--;
+            }
+            else
+            {
+                truncated = true;
+            }
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        integer = false;
+        p++;
+        bool const negative_exponent = p < end && *p == '-';
+        p += p < end && (*p == '-' || *p == '+');
+        if (p == end || *p < '0' || *p > '9')
+        {
+            return false;
+        }
+        int64_t e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            e = e < 100000 ? 10 * e + (*p - '0') : e;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    if (p != end)
+    {
+        return false;
+    }
+
+    char buffer[NUMBER_TEXT_SIZE];
+    bool const is_integer = integer && !truncated &&
+        (mantissa <= INT64_MAX || (negative && mantissa == (u64) INT64_MAX + 1));
+    int64_t ival = 0;
+    double dval = 0;
+    if (is_integer)
+    {
+        ival = negative ? (int64_t) -mantissa : (int64_t) mantissa;
+    }
+    else if (!truncated && mantissa <= NUMBER_MAX_EXACT_MANTISSA &&
+             exponent >= -NUMBER_MAX_EXACT_POWER && exponent <= NUMBER_MAX_EXACT_POWER)
+    {
+        /* an exact mantissa scaled by an exact power of ten is rounded only
+         * once, so it is the correct double */
+        dval = (double) mantissa;
+        dval = exponent < 0 ? dval / g_exact_powers_of_ten[-exponent] : dval * g_exact_powers_of_ten[exponent];
+        dval = negative ? -dval : dval;
+    }
+    else
+    {
+        char * copy = size < NUMBER_TEXT_SIZE ? buffer : (char *) malloc(size + 1);
+        ASSERT(copy);
+        memcpy(copy, text, size);
+        copy[size] = '\0';
+        dval = strtod(copy, NULL);
+        if (copy != buffer)
+        {
+            free(copy);
+        }
+    }
+
+    /* the text is kept if the number would not give it back */
+    bool keep = !is_integer && !isfinite(dval);
+    if (exact && !is_integer && (truncated || num_digits > 15))
+    {
+        /* a double with more digits than that rarely comes back the same
+         * and is slow to write, so it is not tried */
+        keep = true;
+    }
+    else if (exact && is_integer)
+    {
+        /* the syntax leaves an integer no other way to be written */
+        keep = negative && mantissa == 0;
+    }
+    else if (exact && !keep)
+    {
+        size_t const canonical = is_integer ? _format_integer(ival, buffer) : _format_double(dval, buffer);
+        keep = canonical != size || memcmp(buffer, text, size);
+    }
+    size_t const kept = keep ? size : 0;
+    *pexp = is_integer ? _make_integer(ival, text, kept) : _make_double(dval, text, kept);
+    return true;
 }
 
 Expr intern(char const * name)
 {
-    //fprintf(stderr, "%s(\"%s\")\n", __FUNCTION__, name);
-    if (!strcmp("nil", name))
+    return intern_n(name, strlen(name));
+}
+
+Expr intern_n(char const * name, size_t size)
+{
+    //fprintf(stderr, "%s(\"%.*s\")\n", __FUNCTION__, (int) size, name);
+    if (size == 3 && !memcmp("nil", name, 3))
     {
         return nil;
     }
-    else if (name[0] == ':' && name[1] != '\0')
+    else if (size > 1 && name[0] == ':')
     {
-        return make_keyword(name + 1);
+        return make_keyword_n(name + 1, size - 1);
     }
     else
     {
-        return make_symbol(name);
+        return make_symbol_n(name, size);
     }
 }
 
@@ -344,6 +1408,222 @@ void rplacd(Expr exp, Expr val)
     pair_set_second(exp, val);
 }
 
+#define OBJECT_LINEAR_MEMBERS 8
+
+/* the index of an object maps its keys to its members by open addressing;
+ * the indices are themselves kept by open addressing on the pair at the
+ * head of their object */
+typedef struct
+{
+    Expr key;
+    Expr member; /* nil marks an empty slot */
+} ObjectSlot;
+
+typedef struct
+{
+    u64 pair; /* index + 1 of the head pair, 0 marks an empty slot */
+    ObjectSlot * slots;
+    u64 mask;
+    Expr duplicate;
+} ObjectIndex;
+
+static THREAD_LOCAL ObjectIndex * g_object_indices = NULL;
+static THREAD_LOCAL u64 g_num_object_indices = 0;
+static THREAD_LOCAL u64 g_object_index_mask = 0;
+
+static ObjectIndex * _object_index_slot(u64 pair)
+{
+    u64 pos = _hash_mix(pair) & g_object_index_mask;
+    while (g_object_indices[pos].pair && g_object_indices[pos].pair != pair + 1)
+    {
+        pos = (pos + 1) & g_object_index_mask;
+    }
+    return &g_object_indices[pos];
+}
+
+/* rebuilds the table of indices with num_slots slots, dropping the indices
+ * of objects from pair on */
+static void _object_index_rebuild(u64 num_slots, u64 pair)
+{
+    ObjectIndex * old = g_object_indices;
+    u64 const num_old = old ? g_object_index_mask + 1 : 0;
+    g_object_indices = (ObjectIndex *) calloc(num_slots, sizeof(ObjectIndex));
+    ASSERT(g_object_indices);
+    g_object_index_mask = num_slots - 1;
+    g_num_object_indices = 0;
+    for (u64 i = 0; i < num_old; i++)
+    {
+        if (!old[i].pair)
+        {
+            continue;
+        }
+        if (old[i].pair > pair)
+        {
+            free(old[i].slots);
+            continue;
+        }
+        *_object_index_slot(old[i].pair - 1) = old[i];
+        g_num_object_indices++;
+    }
+    free(old);
+}
+
+static void _object_index_rewind(u64 pair)
+{
+    if (g_num_object_indices)
+    {
+        _object_index_rebuild(g_object_index_mask + 1, pair);
+    }
+}
+
+static ObjectIndex const * _object_index(Expr obj)
+{
+    u64 const pair = _pair_index(obj);
+    if (g_object_indices)
+    {
+        ObjectIndex const * index = _object_index_slot(pair);
+        if (index->pair)
+        {
+            return index;
+        }
+    }
+    if (!g_object_indices || 2 * (g_num_object_indices + 1) > g_object_index_mask + 1)
+    {
+        _object_index_rebuild(g_object_indices ? 2 * (g_object_index_mask + 1) : 64, UINT64_MAX);
+    }
+
+    u64 num_members = 0;
+    for (Expr member = cdr(obj); member; member = cddr(member))
+    {
+        num_members++;
+    }
+    u64 num_slots = 16;
+    while (num_slots < 2 * num_members)
+    {
+        num_slots *= 2;
+    }
+
+    ObjectIndex * index = _object_index_slot(pair);
+    index->pair = pair + 1;
+    index->slots = (ObjectSlot *) calloc(num_slots, sizeof(ObjectSlot));
+    ASSERT(index->slots);
+    index->mask = num_slots - 1;
+    index->duplicate = nil;
+    for (Expr member = cdr(obj); member; member = cddr(member))
+    {
+        Expr const key = car(member);
+        u64 pos = _hash_mix(key) & index->mask;
+        while (index->slots[pos].member && index->slots[pos].key != key)
+        {
+            pos = (pos + 1) & index->mask;
+        }
+        if (index->slots[pos].member)
+        {
+            if (!index->duplicate)
+            {
+                index->duplicate = key;
+            }
+            continue;
+        }
+        index->slots[pos].key = key;
+        index->slots[pos].member = member;
+    }
+    g_num_object_indices++;
+    return index;
+}
+
+static Expr _object_index_find(ObjectIndex const * index, Expr key)
+{
+    for (u64 pos = _hash_mix(key) & index->mask; index->slots[pos].member; pos = (pos + 1) & index->mask)
+    {
+        if (index->slots[pos].key == key)
+        {
+            return index->slots[pos].member;
+        }
+    }
+    return nil;
+}
+
+Expr object_find(Expr obj, Expr key)
+{
+    ASSERT(is_pair(obj));
+    if (g_num_object_indices)
+    {
+        ObjectIndex const * index = _object_index_slot(_pair_index(obj));
+        if (index->pair)
+        {
+            return _object_index_find(index, key);
+        }
+    }
+
+    Expr member = cdr(obj);
+    for (int i = 0; i < OBJECT_LINEAR_MEMBERS; i++)
+    {
+        if (!member || car(member) == key)
+        {
+            return member;
+        }
+        member = cddr(member);
+    }
+    if (!member)
+    {
+        return nil;
+    }
+    return _object_index_find(_object_index(obj), key);
+}
+
+Expr object_duplicate_key(Expr obj)
+{
+    ASSERT(is_pair(obj));
+    return _object_index(obj)->duplicate;
+}
+
+HeapMark heap_mark()
+{
+    HeapMark mark;
+    mark.pairs = g_num_pairs;
+    /* the well-known symbols come before every mark */
+    mark.symbols = _symbol_table()->count;
+    mark.keywords = g_keywords.count;
+    mark.name_chunks = g_name_arena.num_chunks;
+    mark.name_used = g_name_arena.used;
+    mark.string_chunks = g_string_arena.num_chunks;
+    mark.string_used = g_string_arena.used;
+    return mark;
+}
+
+void heap_rewind(HeapMark mark)
+{
+    ASSERT(mark.pairs <= g_num_pairs);
+    g_num_pairs = mark.pairs;
+    if (g_num_pairs & PAIR_CHUNK_MASK)
+    {
+        g_pair_next = &g_pair_chunks[g_num_pairs >> PAIR_CHUNK_BITS][g_num_pairs & PAIR_CHUNK_MASK];
+        g_pair_end = g_pair_next + (PAIR_CHUNK_SIZE - (g_num_pairs & PAIR_CHUNK_MASK));
+    }
+    else
+    {
+        /* the next make_pair reuses the chunk that is already allocated */
+        g_pair_next = g_pair_end = NULL;
+    }
+
+    _object_index_rewind(mark.pairs);
+    _name_table_rewind(&g_symbols, mark.symbols);
+    _name_table_rewind(&g_keywords, mark.keywords);
+    _arena_rewind(&g_name_arena, mark.name_chunks, mark.name_used);
+    ASSERT(!g_string_open);
+    _arena_rewind(&g_string_arena, mark.string_chunks, mark.string_used);
+}
+
+void heap_keep_names(HeapMark * mark)
+{
+    HeapMark const now = heap_mark();
+    mark->symbols = now.symbols;
+    mark->keywords = now.keywords;
+    mark->name_chunks = now.name_chunks;
+    mark->name_used = now.name_used;
+}
+
 #endif /* _LISP_C_ */
 
 #endif
@@ -0,0 +1,170 @@
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include "lisp.h"
+
+#include <string.h>
+
+/* buffered output
+ *
+ * bytes are appended to a buffer in whole runs and handed to write(2) in
+ * large blocks once the buffer is full or on output_flush. an output that
+ * is opened on memory has no descriptor; its buffer grows instead and holds
+ * everything written to it until it is closed. */
+
+typedef struct
+{
+    char * buffer;
+    char * cur;
+    char * end;
+    int fd;
+} Output;
+
+void output_open_fd(Output * out, int fd);
+void output_open_memory(Output * out);
+void output_close(Output * out);
+void output_flush(Output * out);
+
+void output_spaces(Output * out, size_t count);
+
+/* the part of output_write that does not fit the buffer */
+void _output_write_slow(Output * out, char const * data, size_t size);
+
+inline static void output_char(Output * out, char ch)
+{
+    if (out->cur == out->end)
+    {
+        _output_write_slow(out, &ch, 1);
+        return;
+    }
+    *out->cur++ = ch;
+}
+
+inline static void output_write(Output * out, char const * data, size_t size)
+{
+    if ((size_t) (out->end - out->cur) < size)
+    {
+        _output_write_slow(out, data, size);
+        return;
+    }
+    memcpy(out->cur, data, size);
+    out->cur += size;
+}
+
+#endif /* _OUTPUT_H_ */
+
+#ifdef OUTPUT_IMPLEMENTATION
+
+#ifndef _OUTPUT_C_
+#define _OUTPUT_C_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE ((size_t) 1 << 18)
+#define OUTPUT_SPACES 1024
+
+static char g_output_spaces[OUTPUT_SPACES];
+
+void output_open_fd(Output * out, int fd)
+{
+    if (g_output_spaces[0] != ' ')
+    {
+        memset(g_output_spaces, ' ', OUTPUT_SPACES);
+    }
+    out->buffer = (char *) malloc(OUTPUT_BUFFER_SIZE);
+    ASSERT(out->buffer);
+    out->cur = out->buffer;
+    out->end = out->buffer + OUTPUT_BUFFER_SIZE;
+    out->fd = fd;
+}
+
+void output_open_memory(Output * out)
+{
+    output_open_fd(out, -1);
+}
+
+void output_close(Output * out)
+{
+    output_flush(out);
+    free(out->buffer);
+    out->buffer = out->cur = out->end = NULL;
+}
+
+static void _output_write_all(int fd, char const * data, size_t size)
+{
+    while (size)
+    {
+        ssize_t count = write(fd, data, size);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            FAIL("write failed: %s\n", strerror(errno));
+        }
+        data += count;
+        size -= count;
+    }
+}
+
+void output_flush(Output * out)
+{
+    if (out->fd >= 0 && out->cur > out->buffer)
+    {
+        _output_write_all(out->fd, out->buffer, out->cur - out->buffer);
+        out->cur = out->buffer;
+    }
+}
+
+static void _output_grow(Output * out, size_t size)
+{
+    size_t const used = out->cur - out->buffer;
+    size_t capacity = out->end - out->buffer;
+    while (capacity - used < size)
+    {
+        capacity *= 2;
+    }
+    out->buffer = (char *) realloc(out->buffer, capacity);
+    ASSERT(out->buffer);
+    out->cur = out->buffer + used;
+    out->end = out->buffer + capacity;
+}
+
+void _output_write_slow(Output * out, char const * data, size_t size)
+{
+    if (out->fd < 0)
+    {
+        _output_grow(out, size);
+        memcpy(out->cur, data, size);
+        out->cur += size;
+        return;
+    }
+    output_flush(out);
+    if (size >= (size_t) (out->end - out->buffer))
+    {
+        _output_write_all(out->fd, data, size);
+    }
+    else
+    {
+        memcpy(out->cur, data, size);
+        out->cur += size;
+    }
+}
+
+void output_spaces(Output * out, size_t count)
+{
+    while (count)
+    {
+        size_t const size = count < OUTPUT_SPACES ? count : OUTPUT_SPACES;
+        output_write(out, g_output_spaces, size);
+        count -= size;
+    }
+}
+
+#endif /* _OUTPUT_C_ */
+
+#endif
@@ -0,0 +1,216 @@
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include "lisp.h"
+#include "input.h"
+#include "output.h"
+
+/* parallel conversion of a stream of independent values
+ *
+ * the input is cut into chunks of whole top-level values, which a pool of
+ * worker threads converts into output buffers of their own. the buffers
+ * are written out in the order of the input, so the result is the same as
+ * converting the stream on one thread.
+ *
+ * the split function is given the unread input and a target size and
+ * returns the size of the shortest run of whole values that is at least
+ * that long, or 0 if data does not have one. the convert function runs on
+ * a worker thread and converts one such run into out. chunks are cut at
+ * chunk_size bytes, or at PARALLEL_CHUNK_SIZE if it is 0. */
+
+typedef size_t (* ParallelSplit)(char const * data, size_t size, size_t target);
+typedef void (* ParallelConvert)(char const * data, size_t size, Output * out);
+
+void parallel_start(int num_threads, size_t chunk_size, ParallelConvert convert);
+void parallel_run(Input * in, Output * out, ParallelSplit split);
+void parallel_stop();
+
+#endif /* _PARALLEL_H_ */
+
+#ifdef PARALLEL_IMPLEMENTATION
+
+#ifndef _PARALLEL_C_
+#define _PARALLEL_C_
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARALLEL_CHUNK_SIZE ((size_t) 1 << 20)
+
+typedef struct
+{
+    char const * data;
+    size_t size;
+    char * copy; /* the chunk, if the input does not stay in memory */
+    Output out;
+    bool done;
+} ParallelJob;
+
+static pthread_t * g_parallel_threads = NULL;
+static int g_parallel_num_threads = 0;
+static size_t g_parallel_chunk_size = PARALLEL_CHUNK_SIZE;
+static ParallelConvert g_parallel_convert;
+
+/* jobs are a ring that is taken by the workers and written by the main
+ * thread in the order they were submitted; it holds two jobs per thread,
+ * which keeps every worker busy while bounding the memory in flight */
+static ParallelJob * g_parallel_jobs = NULL;
+static u64 g_parallel_max_jobs = 0;
+static u64 g_parallel_submitted = 0;
+static u64 g_parallel_taken = 0;
+static u64 g_parallel_written = 0;
+static bool g_parallel_stopping = false;
+
+static pthread_mutex_t g_parallel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_parallel_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_parallel_done = PTHREAD_COND_INITIALIZER;
+
+static void * _parallel_worker(void * arg)
+{
+    pthread_mutex_lock(&g_parallel_lock);
+    while (true)
+    {
+        while (g_parallel_taken == g_parallel_submitted && !g_parallel_stopping)
+        {
+            pthread_cond_wait(&g_parallel_work, &g_parallel_lock);
+        }
+        if (g_parallel_taken == g_parallel_submitted)
+        {
+            break;
+        }
+        ParallelJob * job = &g_parallel_jobs[g_parallel_taken++ % g_parallel_max_jobs];
+        pthread_mutex_unlock(&g_parallel_lock);
+
+        output_open_memory(&job->out);
+        g_parallel_convert(job->data, job->size, &job->out);
+
+        pthread_mutex_lock(&g_parallel_lock);
+        job->done = true;
+        pthread_cond_signal(&g_parallel_done);
+    }
+    pthread_mutex_unlock(&g_parallel_lock);
+    return NULL;
+}
+
+void parallel_start(int num_threads, size_t chunk_size, ParallelConvert convert)
+{
+    ASSERT(num_threads > 0);
+    ASSERT(!g_parallel_threads);
+    g_parallel_convert = convert;
+    g_parallel_chunk_size = chunk_size ? chunk_size : PARALLEL_CHUNK_SIZE;
+    g_parallel_max_jobs = 2 * num_threads;
+    g_parallel_jobs = (ParallelJob *) calloc(g_parallel_max_jobs, sizeof(ParallelJob));
+    ASSERT(g_parallel_jobs);
+    g_parallel_threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    ASSERT(g_parallel_threads);
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (pthread_create(&g_parallel_threads[i], NULL, _parallel_worker, NULL))
+        {
+            FAIL("cannot start worker thread %d\n", i);
+        }
+    }
+    g_parallel_num_threads = num_threads;
+}
+
+void parallel_stop()
+{
+    pthread_mutex_lock(&g_parallel_lock);
+    g_parallel_stopping = true;
+    pthread_cond_broadcast(&g_parallel_work);
+    pthread_mutex_unlock(&g_parallel_lock);
+    for (int i = 0; i < g_parallel_num_threads; i++)
+    {
+        pthread_join(g_parallel_threads[i], NULL);
+    }
+    free(g_parallel_threads);
+    free(g_parallel_jobs);
+    g_parallel_threads = NULL;
+    g_parallel_jobs = NULL;
+    g_parallel_num_threads = 0;
+}
+
+/* waits for the oldest job and writes its output */
+static void _parallel_write_next(Output * out)
+{
+    ParallelJob * job = &g_parallel_jobs[g_parallel_written % g_parallel_max_jobs];
+    pthread_mutex_lock(&g_parallel_lock);
+    while (!job->done)
+    {
+        pthread_cond_wait(&g_parallel_done, &g_parallel_lock);
+    }
+    pthread_mutex_unlock(&g_parallel_lock);
+
+    output_write(out, job->out.buffer, job->out.cur - job->out.buffer);
+    output_close(&job->out);
+    free(job->copy);
+    job->copy = NULL;
+    g_parallel_written++;
+}
+
+static void _parallel_submit(Output * out, char const * data, size_t size, bool copy)
+{
+    if (g_parallel_submitted - g_parallel_written == g_parallel_max_jobs)
+    {
+        _parallel_write_next(out);
+    }
+    ParallelJob * job = &g_parallel_jobs[g_parallel_submitted % g_parallel_max_jobs];
+    if (copy)
+    {
+        job->copy = (char *) malloc(size);
+        ASSERT(job->copy);
+        memcpy(job->copy, data, size);
+        data = job->copy;
+    }
+    job->data = data;
+    job->size = size;
+    job->done = false;
+
+    pthread_mutex_lock(&g_parallel_lock);
+    g_parallel_submitted++;
+    pthread_cond_signal(&g_parallel_work);
+    pthread_mutex_unlock(&g_parallel_lock);
+}
+
+void parallel_run(Input * in, Output * out, ParallelSplit split)
+{
+    ASSERT(g_parallel_threads);
+    bool const resident = input_resident(in);
+    size_t want = g_parallel_chunk_size;
+    while (input_peek(in) != -1)
+    {
+        /* the unread part of the buffer is kept across refills, so read
+         * until there is enough of it to cut a chunk from */
+        while ((size_t) (in->end - in->cur) < want && input_fill(in))
+        {
+        }
+        size_t const avail = in->end - in->cur;
+        size_t size = split(in->cur, avail, g_parallel_chunk_size);
+        if (size == 0)
+        {
+            if (avail >= want)
+            {
+                /* a single value that is longer than what was read; the
+                 * next attempt reads twice as much, so the input is only
+                 * scanned a bounded number of times over */
+                want = 2 * avail;
+                continue;
+            }
+            /* the rest of the input, which ends the stream */
+            size = avail;
+        }
+        _parallel_submit(out, in->cur, size, !resident);
+        in->cur += size;
+        want = g_parallel_chunk_size;
+    }
+    while (g_parallel_written < g_parallel_submitted)
+    {
+        _parallel_write_next(out);
+    }
+}
+
+#endif /* _PARALLEL_C_ */
+
+#endif
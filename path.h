@@ -0,0 +1,660 @@
+
+#ifndef _PATH_H_
+#define _PATH_H_
+
+#include "lisp.h"
+#include "input.h"
+#include "scan.h"
+#include "sexp.h"
+
+/* paths into nested objects and arrays
+ *
+ * a path is a list of steps separated by slashes, as in :args/0/name; a
+ * number goes to the element of an array at that position, counting from
+ * 0, and any other step goes to the member of an object with that name,
+ * which can be written as a keyword. the names point into the string the
+ * path was parsed from. */
+
+typedef struct
+{
+    char const * name; /* NULL if the step is an element of an array */
+    size_t size;
+    u64 index;
+} PathStep;
+
+typedef struct
+{
+    PathStep * steps;
+    size_t num_steps;
+} Path;
+
+void path_parse(Path * path, char const * str);
+
+/* a test of the value at a path against a literal, as in
+ * :class == "pointer". a literal in quotes is compared with the contents
+ * of a string, so its escapes are decoded when it is parsed; anything else
+ * is compared with an atom as it is written. a value that is missing or is
+ * an object or array is different from every literal. */
+
+typedef struct
+{
+    Path path;
+    char const * literal;
+    size_t size;
+    bool string;
+    bool equal; /* == rather than != */
+} PathTest;
+
+void path_parse_test(PathTest * test, char const * str);
+
+/* a path reader follows paths into the values at an input without building
+ * them, and skips everything off the path by scanning for the brackets that
+ * balance it. it reads json, or s-expressions, where a list that starts
+ * with object or dict is an object and one that starts with array or list
+ * is an array; a key that ends its object there has the value nil, as it
+ * does in the tree. */
+
+typedef struct
+{
+    Input * in;
+    ScanIndex * index; /* jumps over whitespace in resident input, or NULL */
+    bool json;
+} PathReader;
+
+/* what path_follow leads to */
+enum
+{
+    PATH_NONE,
+    PATH_VALUE, /* a value, which is next in the input */
+    PATH_NIL, /* a key that ends its object, with the input at the close */
+};
+
+void path_reader_open(PathReader * reader, Input * in, ScanIndex * index, bool json);
+
+void path_skip_whitespace(PathReader * reader);
+
+/* skips the value at the input */
+void path_skip_value(PathReader * reader);
+
+/* skips input until depth more objects, arrays or lists are closed than
+ * are opened */
+void path_skip_to_close(PathReader * reader, size_t depth);
+
+/* follows path into the value at the input. the objects and arrays that
+ * were entered are counted in depth, and path_skip_to_close(depth) skips
+ * what is left of the value whatever the path leads to. */
+int path_follow(PathReader * reader, Path const * path, size_t * pdepth);
+
+/* tells whether the value at the input passes test. a value that passes is
+ * left to be read from its start, which a mark keeps in the input, and one
+ * that fails is skipped as soon as the test fails. */
+bool path_test_passes(PathReader * reader, PathTest const * test);
+
+#endif /* _PATH_H_ */
+
+#ifdef PATH_IMPLEMENTATION
+
+#ifndef _PATH_C_
+#define _PATH_C_
+
+#include <stdlib.h>
+#include <string.h>
+
+void path_parse(Path * path, char const * str)
+{
+    size_t max_steps = 1;
+    for (char const * p = str; *p; p++)
+    {
+        max_steps += *p == '/';
+    }
+    path->steps = (PathStep *) malloc(max_steps * sizeof(PathStep));
+    ASSERT(path->steps);
+    path->num_steps = 0;
+
+    char const * p = str;
+    while (true)
+    {
+        char const * end = strchr(p, '/');
+        if (!end)
+        {
+            end = p + strlen(p);
+        }
+        PathStep * step = &path->steps[path->num_steps++];
+        step->name = NULL;
+        step->size = 0;
+        step->index = 0;
+        if (*p >= '0' && *p <= '9')
+        {
+            for (char const * q = p; q < end; q++)
+            {
+                if (*q < '0' || *q > '9' || step->index > (UINT64_MAX - 9) / 10)
+                {
+                    FAIL("bad index %.*s in path %s\n", (int) (end - p), p, str);
+                }
+                step->index = 10 * step->index + (*q - '0');
+            }
+        }
+        else
+        {
+            step->name = *p == ':' ? p + 1 : p;
+            step->size = end - step->name;
+            if (!step->size)
+            {
+                FAIL("empty step in path %s\n", str);
+            }
+        }
+        if (!*end)
+        {
+            break;
+        }
+        p = end + 1;
+    }
+}
+
+static char const * _path_trim(char const * p, char const ** end)
+{
+    while (p < *end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    while (*end > p && ((*end)[-1] == ' ' || (*end)[-1] == '\t'))
+    {
+        (*end)--;
+    }
+    return p;
+}
+
+void path_parse_test(PathTest * test, char const * str)
+{
+    char const * op = strstr(str, "==");
+    char const * ne = strstr(str, "!=");
+    if (!op || (ne && ne < op))
+    {
+        op = ne;
+    }
+    if (!op)
+    {
+        FAIL("expected == or != in %s\n", str);
+    }
+    test->equal = op[0] == '=';
+
+    char const * end = op;
+    char const * p = _path_trim(str, &end);
+    if (p == end)
+    {
+        FAIL("no path in %s\n", str);
+    }
+    /* the path is parsed from a copy of its own, which stays alive for the
+     * names in it */
+    char * path = (char *) malloc(end - p + 1);
+    ASSERT(path);
+    memcpy(path, p, end - p);
+    path[end - p] = '\0';
+    path_parse(&test->path, path);
+
+    end = op + strlen(op);
+    p = _path_trim(op + 2, &end);
+    if (p == end)
+    {
+        FAIL("no literal in %s\n", str);
+    }
+    test->string = end - p >= 2 && *p == '"' && end[-1] == '"';
+    if (!test->string)
+    {
+        test->literal = p;
+        test->size = end - p;
+        return;
+    }
+
+    /* the contents are decoded into a copy, which is never longer than
+     * the escapes it is decoded from */
+    p++;
+    end--;
+    char * literal = (char *) malloc(end - p + 1);
+    ASSERT(literal);
+    size_t size = 0;
+    while (p < end)
+    {
+        if (*p != '\\')
+        {
+            literal[size++] = *p++;
+            continue;
+        }
+        char utf8[SCAN_ESCAPE_UTF8_SIZE];
+        size_t utf8_size;
+        char const * next = scan_escape(p, end, utf8, &utf8_size);
+        if (!next)
+        {
+            FAIL("bad escape in literal %s\n", str);
+        }
+        memcpy(literal + size, utf8, utf8_size);
+        size += utf8_size;
+        p = next;
+    }
+    test->literal = literal;
+    test->size = size;
+}
+
+void path_reader_open(PathReader * reader, Input * in, ScanIndex * index, bool json)
+{
+    reader->in = in;
+    reader->index = index;
+    reader->json = json;
+}
+
+void path_skip_whitespace(PathReader * reader)
+{
+    Input * in = reader->in;
+    if (reader->index && reader->index->offsets && in->cur < in->end && scan_is_whitespace(*in->cur))
+    {
+        char const * next = scan_index_next(reader->index, in->cur);
+        if (next)
+        {
+            in->cur = next;
+            return;
+        }
+    }
+    do
+    {
+        in->cur = scan_whitespace(in->cur, in->end);
+    }
+    while (in->cur == in->end && input_fill(in));
+}
+
+inline static bool _path_opens(PathReader const * reader, int ch)
+{
+    return reader->json ? ch == '{' || ch == '[' : ch == '(';
+}
+
+inline static bool _path_closes(PathReader const * reader, int ch)
+{
+    return reader->json ? ch == '}' || ch == ']' : ch == ')';
+}
+
+static void _path_skip_string(Input * in)
+{
+    ASSERT(input_peek(in) == '"');
+    input_advance(in);
+    while (true)
+    {
+        do
+        {
+            in->cur = scan_string(in->cur, in->end);
+        }
+        while (in->cur == in->end && input_fill(in));
+
+        int ch = input_peek(in);
+        if (ch == -1)
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+        }
+        input_advance(in);
+        if (ch == '"')
+        {
+            return;
+        }
+        /* the byte after a backslash */
+        if (input_peek(in) == -1)
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+        }
+        input_advance(in);
+    }
+}
+
+/* consumes a string and tells whether its value is the size bytes at name,
+ * comparing it a run at a time without making a copy */
+static bool _path_match_string(Input * in, char const * name, size_t size)
+{
+    ASSERT(input_peek(in) == '"');
+    input_advance(in);
+    bool match = true;
+    while (true)
+    {
+        char const * p = scan_string(in->cur, in->end);
+        size_t const run = p - in->cur;
+        match = match && run <= size && !memcmp(in->cur, name, run);
+        if (match)
+        {
+            name += run;
+            size -= run;
+        }
+        in->cur = p;
+        if (p == in->end)
+        {
+            if (!input_fill(in))
+            {
+                FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+            }
+            continue;
+        }
+
+        if (*p == '"')
+        {
+            input_advance(in);
+            return match && size == 0;
+        }
+        char bytes[SCAN_ESCAPE_UTF8_SIZE];
+        size_t count;
+        sexp_read_escape(in, bytes, &count);
+        match = match && count <= size && !memcmp(name, bytes, count);
+        if (match)
+        {
+            name += count;
+            size -= count;
+        }
+    }
+}
+
+/* skips an atom, or a stray byte on its own */
+static void _path_skip_atom(PathReader * reader)
+{
+    Input * in = reader->in;
+    input_advance(in);
+    do
+    {
+        in->cur = reader->json ? scan_json_atom(in->cur, in->end) : scan_sexp_atom(in->cur, in->end);
+    }
+    while (in->cur == in->end && input_fill(in));
+}
+
+void path_skip_to_close(PathReader * reader, size_t depth)
+{
+    Input * in = reader->in;
+    /* resident input is skipped a block at a time */
+    if (depth && input_resident(in))
+    {
+        char const * p = scan_balanced(in->cur, in->end, depth, reader->json);
+        if (p)
+        {
+            in->cur = p;
+            return;
+        }
+    }
+
+    while (depth)
+    {
+        path_skip_whitespace(reader);
+        int const ch = input_peek(in);
+        if (ch == -1)
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+        }
+        else if (_path_opens(reader, ch))
+        {
+            input_advance(in);
+            depth++;
+        }
+        else if (_path_closes(reader, ch))
+        {
+            input_advance(in);
+            depth--;
+        }
+        else if (ch == '"')
+        {
+            _path_skip_string(in);
+        }
+        else if (reader->json && (ch == ',' || ch == ':'))
+        {
+            input_advance(in);
+        }
+        else
+        {
+            _path_skip_atom(reader);
+        }
+    }
+}
+
+void path_skip_value(PathReader * reader)
+{
+    Input * in = reader->in;
+    path_skip_whitespace(reader);
+    int const ch = input_peek(in);
+    if (ch == -1 || _path_closes(reader, ch))
+    {
+        FAIL("unexpected %s in %s()\n", ch == -1 ? "end of stream" : "close", __FUNCTION__);
+    }
+    else if (_path_opens(reader, ch))
+    {
+        input_advance(in);
+        path_skip_to_close(reader, 1);
+    }
+    else if (ch == '"')
+    {
+        _path_skip_string(in);
+    }
+    else
+    {
+        _path_skip_atom(reader);
+    }
+}
+
+/* moves past the whitespace and, in json, the comma before the next member
+ * or element of what was entered */
+static void _path_skip_separator(PathReader * reader)
+{
+    path_skip_whitespace(reader);
+    if (reader->json && input_peek(reader->in) == ',')
+    {
+        input_advance(reader->in);
+        path_skip_whitespace(reader);
+    }
+}
+
+enum
+{
+    _PATH_LIST,
+    _PATH_OBJECT,
+    _PATH_ARRAY,
+};
+
+static bool _path_token_is(Input * in, char const * str)
+{
+    size_t const size = strlen(str);
+    return input_token_size(in) == size && !memcmp(in->token, str, size);
+}
+
+/* enters the object, array or list at the input and returns which it is,
+ * going by the symbol at the head of a list */
+static int _path_enter(PathReader * reader)
+{
+    Input * in = reader->in;
+    int const open = input_peek(in);
+    input_advance(in);
+    if (reader->json)
+    {
+        return open == '{' ? _PATH_OBJECT : _PATH_ARRAY;
+    }
+
+    path_skip_whitespace(reader);
+    int const ch = input_peek(in);
+    if (ch == ')' || ch == '(' || ch == '"' || ch == -1)
+    {
+        return _PATH_LIST;
+    }
+    sexp_read_token(in);
+    int kind = _PATH_LIST;
+    if (_path_token_is(in, "object") || _path_token_is(in, "dict"))
+    {
+        kind = _PATH_OBJECT;
+    }
+    else if (_path_token_is(in, "array") || _path_token_is(in, "list"))
+    {
+        kind = _PATH_ARRAY;
+    }
+    input_end_token(in);
+    return kind;
+}
+
+/* moves to the value of the member name in the object that was entered */
+static int _path_find_member(PathReader * reader, char const * name, size_t size)
+{
+    Input * in = reader->in;
+    while (true)
+    {
+        _path_skip_separator(reader);
+        int const ch = input_peek(in);
+        bool match = false;
+        if (reader->json)
+        {
+            if (ch != '"')
+            {
+                return PATH_NONE;
+            }
+            match = _path_match_string(in, name, size);
+            path_skip_whitespace(reader);
+            if (input_peek(in) != ':')
+            {
+                FAIL("expected ':' after object key\n");
+            }
+            input_advance(in);
+        }
+        else
+        {
+            if (ch == ')' || ch == -1)
+            {
+                return PATH_NONE;
+            }
+            if (ch == ':')
+            {
+                sexp_read_token(in);
+                match = input_token_size(in) == size + 1 && !memcmp(in->token + 1, name, size);
+                input_end_token(in);
+            }
+            else
+            {
+                path_skip_value(reader);
+            }
+            path_skip_whitespace(reader);
+            if (input_peek(in) == ')')
+            {
+                return match ? PATH_NIL : PATH_NONE;
+            }
+        }
+        if (match)
+        {
+            path_skip_whitespace(reader);
+            return PATH_VALUE;
+        }
+        path_skip_value(reader);
+    }
+}
+
+/* moves to the element at index in the array that was entered */
+static int _path_find_element(PathReader * reader, u64 index)
+{
+    for (u64 i = 0; ; i++)
+    {
+        _path_skip_separator(reader);
+        int const ch = input_peek(reader->in);
+        if (ch == -1 || _path_closes(reader, ch))
+        {
+            return PATH_NONE;
+        }
+        if (i == index)
+        {
+            return PATH_VALUE;
+        }
+        path_skip_value(reader);
+    }
+}
+
+int path_follow(PathReader * reader, Path const * path, size_t * pdepth)
+{
+    *pdepth = 0;
+    int found = PATH_VALUE;
+    for (size_t i = 0; i < path->num_steps; i++)
+    {
+        PathStep const * step = &path->steps[i];
+        /* nil has no members, and nothing to skip */
+        if (found == PATH_NIL)
+        {
+            return PATH_NONE;
+        }
+        path_skip_whitespace(reader);
+        if (!_path_opens(reader, input_peek(reader->in)))
+        {
+            path_skip_value(reader);
+            return PATH_NONE;
+        }
+        int const kind = _path_enter(reader);
+        ++*pdepth;
+        found = PATH_NONE;
+        if (kind == _PATH_OBJECT && step->name)
+        {
+            found = _path_find_member(reader, step->name, step->size);
+        }
+        else if (kind == _PATH_ARRAY && !step->name)
+        {
+            found = _path_find_element(reader, step->index);
+        }
+        if (found == PATH_NONE)
+        {
+            return PATH_NONE;
+        }
+    }
+    return found;
+}
+
+/* consumes the value that a test leads to and tells whether it equals the
+ * literal of the test */
+static bool _path_match_literal(PathReader * reader, PathTest const * test, int found)
+{
+    Input * in = reader->in;
+    if (found == PATH_NIL)
+    {
+        return !test->string && test->size == 3 && !memcmp(test->literal, "nil", 3);
+    }
+    path_skip_whitespace(reader);
+    int const ch = input_peek(in);
+    if (_path_opens(reader, ch))
+    {
+        path_skip_value(reader);
+        return false;
+    }
+    if (ch == '"')
+    {
+        if (test->string)
+        {
+            return _path_match_string(in, test->literal, test->size);
+        }
+        _path_skip_string(in);
+        return false;
+    }
+
+    input_begin_token(in);
+    do
+    {
+        in->cur = reader->json ? scan_json_atom(in->cur, in->end) : scan_sexp_atom(in->cur, in->end);
+    }
+    while (in->cur == in->end && input_fill(in));
+    bool const match = !test->string && input_token_size(in) == test->size &&
+        !memcmp(in->token, test->literal, test->size);
+    input_end_token(in);
+    return match;
+}
+
+bool path_test_passes(PathReader * reader, PathTest const * test)
+{
+    Input * in = reader->in;
+    input_set_mark(in);
+    size_t depth;
+    int const found = path_follow(reader, &test->path, &depth);
+    bool const equal = found != PATH_NONE && _path_match_literal(reader, test, found);
+    if (equal == test->equal)
+    {
+        input_reset_to_mark(in);
+        if (reader->index && reader->index->offsets)
+        {
+            scan_index_rewind(reader->index, in->cur);
+        }
+        return true;
+    }
+    input_clear_mark(in);
+    path_skip_to_close(reader, depth);
+    return false;
+}
+
+#endif /* _PATH_C_ */
+
+#endif
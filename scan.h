@@ -0,0 +1,1245 @@
+
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include "lisp.h"
+
+/* scanning kernels for the lexers
+ *
+ * each kernel takes the unread run p..end and returns a pointer to the
+ * first byte that ends the run, or end. the kernels work on 32 or 16 bytes
+ * at a time with avx2 or sse2 when the cpu has them; scan_init picks the
+ * best variant at startup, and the environment variable SEXP_SCAN=scalar,
+ * sse2 or avx2 overrides the choice. */
+
+typedef char const * (* ScanFn)(char const * p, char const * end);
+
+/* the classes of the 64 bytes of a block, one bit per byte */
+typedef struct
+{
+    u64 quote;
+    u64 backslash;
+    u64 whitespace;
+    u64 structural;
+    u64 open;  /* the brackets that open a list, object or array */
+    u64 close;
+} ScanMasks;
+
+typedef void (* ScanClassifyFn)(char const * block, bool json, ScanMasks * masks);
+
+typedef struct
+{
+    ScanFn whitespace;  /* first byte that is not whitespace */
+    ScanFn string;      /* first '"' or '\\' */
+    ScanFn string_utf8; /* the same, or the first byte that does not start
+                         * a valid utf-8 sequence that ends before end */
+    ScanFn to_escape;   /* first '"', '\\' or control character */
+    ScanFn sexp_atom;   /* first byte that ends an s-expression atom */
+    ScanFn json_atom;   /* first byte that ends a json atom */
+    ScanClassifyFn classify;
+    char const * name;
+} Scanner;
+
+extern Scanner g_scan;
+
+void scan_init();
+
+inline static char const * scan_whitespace(char const * p, char const * end)
+{
+    return g_scan.whitespace(p, end);
+}
+
+inline static char const * scan_string(char const * p, char const * end)
+{
+    return g_scan.string(p, end);
+}
+
+inline static char const * scan_string_utf8(char const * p, char const * end)
+{
+    return g_scan.string_utf8(p, end);
+}
+
+inline static char const * scan_to_escape(char const * p, char const * end)
+{
+    return g_scan.to_escape(p, end);
+}
+
+inline static char const * scan_sexp_atom(char const * p, char const * end)
+{
+    return g_scan.sexp_atom(p, end);
+}
+
+inline static char const * scan_json_atom(char const * p, char const * end)
+{
+    return g_scan.json_atom(p, end);
+}
+
+/* escapes in strings
+ *
+ * scan_escape decodes the escape that starts with the backslash at p into
+ * the utf-8 bytes at out, which has room for SCAN_ESCAPE_UTF8_SIZE, and
+ * returns the byte after it. an escape is one of \" \\ \/ \b \f \n \r \t,
+ * or \u and four hex digits, where a surrogate has to be followed by the
+ * other half of its pair. returns NULL if it is not a valid escape or if
+ * end comes first, which it does not when SCAN_ESCAPE_SIZE bytes from p are
+ * all there. */
+
+#define SCAN_ESCAPE_SIZE 12
+#define SCAN_ESCAPE_UTF8_SIZE 4
+
+char const * scan_escape(char const * p, char const * end, char * out, size_t * psize);
+
+/* the escape that a string is written with for each of the bytes that
+ * scan_to_escape stops at: the short form where there is one and \u00XX
+ * for the other control characters */
+typedef struct
+{
+    char text[7];
+    unsigned char size;
+} ScanEscapeText;
+
+extern ScanEscapeText g_scan_escape_text[256];
+
+/* structural index
+ *
+ * a first pass over resident input that finds where every token starts:
+ * the brackets outside of strings, the quotes that open strings and the
+ * first byte of every atom. input is classified into bit masks 64 bytes at
+ * a time; escaped quotes are found from the runs of backslashes, and what
+ * is inside a string is the prefix xor of the quotes that are left. the
+ * index is built a window at a time as it is asked for, so it stays small
+ * however long the input is.
+ *
+ * backslashes only mean something inside strings. when one turns up
+ * outside of a string, the index stops before that block and says that it
+ * does not know about the rest, and the reader scans bytes instead. */
+
+typedef struct
+{
+    char const * base;  /* the offsets are relative to the window at base */
+    char const * next;  /* the first byte that is not indexed yet */
+    char const * end;
+    u32 * offsets;
+    size_t num_offsets;
+    size_t pos;         /* the first offset that has not been passed */
+    u64 in_string;      /* all ones if next is inside a string */
+    u64 escaped;        /* 1 if the byte at next is escaped */
+    u64 scalar;         /* 1 if the byte before next is part of an atom */
+    bool json;
+    bool stopped;
+} ScanIndex;
+
+void scan_index_open(ScanIndex * index, char const * data, size_t size, bool json);
+void scan_index_close(ScanIndex * index);
+
+/* lets p go back to a place it has already passed, which has to be outside
+ * of any string or atom */
+void scan_index_rewind(ScanIndex * index, char const * p);
+
+/* indexes the next window of input from p on */
+void _scan_index_fill(ScanIndex * index, char const * p);
+
+/* returns the first token that starts at or after p, end if there is none,
+ * or NULL if the index stopped before p. p must not go backwards between
+ * calls. when it moves past what has been indexed, it has to be outside of
+ * any string or atom; indexing then starts over at p and never looks at
+ * what lies between. */
+inline static char const * scan_index_next(ScanIndex * index, char const * p)
+{
+    while (true)
+    {
+        if (index->num_offsets && index->base + index->offsets[index->num_offsets - 1] < p)
+        {
+            index->pos = index->num_offsets;
+        }
+        while (index->pos < index->num_offsets)
+        {
+            char const * q = index->base + index->offsets[index->pos];
+            if (q >= p)
+            {
+                return q;
+            }
+            index->pos++;
+        }
+        if (index->stopped)
+        {
+            return NULL;
+        }
+        if (index->next == index->end || p == index->end)
+        {
+            return index->end;
+        }
+        _scan_index_fill(index, p);
+    }
+}
+
+inline static bool scan_is_whitespace(int ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+}
+
+/* skips p..end until depth more brackets are closed than are opened and
+ * returns the byte after the last close; p must be outside of any string.
+ * blocks where the depth cannot reach 0 are passed with a count of their
+ * brackets. returns NULL if end comes first or there is a backslash outside
+ * of a string, in which case the caller has to scan the bytes itself. */
+char const * scan_balanced(char const * p, char const * end, size_t depth, bool json);
+
+#endif /* _SCAN_H_ */
+
+#ifdef SCAN_IMPLEMENTATION
+
+#ifndef _SCAN_C_
+#define _SCAN_C_
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+enum
+{
+    SCAN_WHITESPACE = 1,
+    SCAN_STRING = 2,
+    SCAN_SEXP_DELIMITER = 4,
+    SCAN_JSON_DELIMITER = 8,
+    SCAN_SEXP_STRUCTURAL = 16,
+    SCAN_JSON_STRUCTURAL = 32,
+    SCAN_ESCAPE = 64,
+};
+
+static unsigned char g_scan_class[256];
+
+ScanEscapeText g_scan_escape_text[256];
+
+static void _scan_init_escapes()
+{
+    static char const hex[] = "0123456789abcdef";
+    for (int ch = 0; ch < 0x20; ch++)
+    {
+        ScanEscapeText * const esc = &g_scan_escape_text[ch];
+        memcpy(esc->text, "\\u00", 4);
+        esc->text[4] = hex[ch >> 4];
+        esc->text[5] = hex[ch & 15];
+        esc->size = 6;
+    }
+    char const * const shorts = "\"\"\\\\\bb\ff\nn\rr\tt";
+    for (char const * p = shorts; *p; p += 2)
+    {
+        ScanEscapeText * const esc = &g_scan_escape_text[(unsigned char) p[0]];
+        esc->text[0] = '\\';
+        esc->text[1] = p[1];
+        esc->size = 2;
+    }
+}
+
+static void _scan_init_classes()
+{
+    char const * const whitespace = " \n\t\r";
+    for (char const * p = whitespace; *p; p++)
+    {
+        g_scan_class[(unsigned char) *p] |= SCAN_WHITESPACE | SCAN_SEXP_DELIMITER | SCAN_JSON_DELIMITER;
+    }
+    g_scan_class['"'] |= SCAN_STRING | SCAN_ESCAPE | SCAN_SEXP_DELIMITER | SCAN_JSON_DELIMITER;
+    g_scan_class['\\'] |= SCAN_STRING | SCAN_ESCAPE;
+    for (int ch = 0; ch < 0x20; ch++)
+    {
+        g_scan_class[ch] |= SCAN_ESCAPE;
+    }
+    for (char const * p = "()"; *p; p++)
+    {
+        g_scan_class[(unsigned char) *p] |= SCAN_SEXP_DELIMITER | SCAN_JSON_DELIMITER;
+    }
+    for (char const * p = "{}[],"; *p; p++)
+    {
+        g_scan_class[(unsigned char) *p] |= SCAN_JSON_DELIMITER;
+    }
+
+    /* the json reader ends atoms at parentheses as well, so they start
+     * tokens of their own in both languages */
+    g_scan_class['('] |= SCAN_SEXP_STRUCTURAL | SCAN_JSON_STRUCTURAL;
+    g_scan_class[')'] |= SCAN_SEXP_STRUCTURAL | SCAN_JSON_STRUCTURAL;
+    for (char const * p = "{}[],:"; *p; p++)
+    {
+        g_scan_class[(unsigned char) *p] |= SCAN_JSON_STRUCTURAL;
+    }
+}
+
+static char const * _scan_scalar_whitespace(char const * p, char const * end)
+{
+    while (p < end && (g_scan_class[(unsigned char) *p] & SCAN_WHITESPACE))
+    {
+        p++;
+    }
+    return p;
+}
+
+#define SCAN_SCALAR_UNTIL(name, cls) \
+    static char const * name(char const * p, char const * end) \
+    { \
+        while (p < end && !(g_scan_class[(unsigned char) *p] & (cls))) \
+        { \
+            p++; \
+        } \
+        return p; \
+    }
+
+SCAN_SCALAR_UNTIL(_scan_scalar_string, SCAN_STRING)
+SCAN_SCALAR_UNTIL(_scan_scalar_sexp_atom, SCAN_SEXP_DELIMITER)
+SCAN_SCALAR_UNTIL(_scan_scalar_json_atom, SCAN_JSON_DELIMITER)
+SCAN_SCALAR_UNTIL(_scan_scalar_to_escape, SCAN_ESCAPE)
+
+/* the size of the utf-8 sequence that starts with the byte at p, which is
+ * not ascii, or 0 if it is not valid or goes past end. overlong forms,
+ * surrogates and code points past U+10FFFF are not valid. */
+static size_t _scan_utf8_sequence(char const * p, char const * end)
+{
+    unsigned char const * const s = (unsigned char const *) p;
+    size_t const avail = end - p;
+    unsigned char const lead = s[0];
+    size_t size;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        size = 2;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        size = 3;
+        lo = lead == 0xe0 ? 0xa0 : 0x80;
+        hi = lead == 0xed ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        size = 4;
+        lo = lead == 0xf0 ? 0x90 : 0x80;
+        hi = lead == 0xf4 ? 0x8f : 0xbf;
+    }
+    else
+    {
+        return 0;
+    }
+    if (avail < size || s[1] < lo || s[1] > hi)
+    {
+        return 0;
+    }
+    for (size_t i = 2; i < size; i++)
+    {
+        if (s[i] < 0x80 || s[i] > 0xbf)
+        {
+            return 0;
+        }
+    }
+    return size;
+}
+
+static char const * _scan_scalar_string_utf8(char const * p, char const * end)
+{
+    while (p < end)
+    {
+        unsigned char const ch = *p;
+        if (ch == '"' || ch == '\\')
+        {
+            return p;
+        }
+        if (ch < 0x80)
+        {
+            p++;
+            continue;
+        }
+        size_t const size = _scan_utf8_sequence(p, end);
+        if (!size)
+        {
+            return p;
+        }
+        p += size;
+    }
+    return p;
+}
+
+static void _scan_scalar_classify(char const * block, bool json, ScanMasks * masks)
+{
+    int const structural = json ? SCAN_JSON_STRUCTURAL : SCAN_SEXP_STRUCTURAL;
+    ScanMasks m = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 64; i++)
+    {
+        unsigned char const ch = block[i];
+        u64 const bit = (u64) 1 << i;
+        m.quote |= ch == '"' ? bit : 0;
+        m.backslash |= ch == '\\' ? bit : 0;
+        m.whitespace |= (g_scan_class[ch] & SCAN_WHITESPACE) ? bit : 0;
+        m.structural |= (g_scan_class[ch] & structural) ? bit : 0;
+        m.open |= (json ? ch == '{' || ch == '[' : ch == '(') ? bit : 0;
+        m.close |= (json ? ch == '}' || ch == ']' : ch == ')') ? bit : 0;
+    }
+    *masks = m;
+}
+
+#if SCAN_X86
+
+/* the match functions return a byte mask of the bytes that end a run */
+
+#define SCAN_ANY(eq, or, set1, v, a, b) or(eq(v, set1(a)), eq(v, set1(b)))
+
+static inline __m128i _sse2_whitespace(__m128i v)
+{
+    return _mm_or_si128(SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, ' ', '\n'),
+                        SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '\t', '\r'));
+}
+
+static inline __m128i _sse2_not_whitespace(__m128i v)
+{
+    return _mm_xor_si128(_sse2_whitespace(v), _mm_set1_epi8(-1));
+}
+
+static inline __m128i _sse2_string(__m128i v)
+{
+    return SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '"', '\\');
+}
+
+/* the control characters are the bytes that are at most 0x1f unsigned */
+static inline __m128i _sse2_to_escape(__m128i v)
+{
+    __m128i const control = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+    return _mm_or_si128(_sse2_string(v), control);
+}
+
+static inline __m128i _sse2_sexp_atom(__m128i v)
+{
+    return _mm_or_si128(_mm_or_si128(_sse2_whitespace(v), _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+                        SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '(', ')'));
+}
+
+static inline __m128i _sse2_json_atom(__m128i v)
+{
+    __m128i brackets = _mm_or_si128(SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '{', '}'),
+                                    SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '[', ']'));
+    return _mm_or_si128(_mm_or_si128(_sse2_sexp_atom(v), brackets), _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_whitespace(__m256i v)
+{
+    return _mm256_or_si256(SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, ' ', '\n'),
+                           SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '\t', '\r'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_not_whitespace(__m256i v)
+{
+    return _mm256_xor_si256(_avx2_whitespace(v), _mm256_set1_epi8(-1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_string(__m256i v)
+{
+    return SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '"', '\\');
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_to_escape(__m256i v)
+{
+    __m256i const control = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+    return _mm256_or_si256(_avx2_string(v), control);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_sexp_atom(__m256i v)
+{
+    return _mm256_or_si256(_mm256_or_si256(_avx2_whitespace(v), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))),
+                           SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '(', ')'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_json_atom(__m256i v)
+{
+    __m256i brackets = _mm256_or_si256(SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '{', '}'),
+                                       SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '[', ']'));
+    return _mm256_or_si256(_mm256_or_si256(_avx2_sexp_atom(v), brackets), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+}
+
+static inline __m128i _sse2_quote(__m128i v)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+}
+
+static inline __m128i _sse2_backslash(__m128i v)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+}
+
+static inline __m128i _sse2_sexp_structural(__m128i v)
+{
+    return SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '(', ')');
+}
+
+static inline __m128i _sse2_json_structural(__m128i v)
+{
+    __m128i brackets = _mm_or_si128(SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '{', '}'),
+                                    SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '[', ']'));
+    return _mm_or_si128(_mm_or_si128(_sse2_sexp_structural(v), brackets),
+                        SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, ',', ':'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_quote(__m256i v)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_backslash(__m256i v)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_sexp_structural(__m256i v)
+{
+    return SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '(', ')');
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_json_structural(__m256i v)
+{
+    __m256i brackets = _mm256_or_si256(SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '{', '}'),
+                                       SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '[', ']'));
+    return _mm256_or_si256(_mm256_or_si256(_avx2_sexp_structural(v), brackets),
+                           SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, ',', ':'));
+}
+
+static inline __m128i _sse2_sexp_open(__m128i v)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8('('));
+}
+
+static inline __m128i _sse2_sexp_close(__m128i v)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(')'));
+}
+
+static inline __m128i _sse2_json_open(__m128i v)
+{
+    return SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '{', '[');
+}
+
+static inline __m128i _sse2_json_close(__m128i v)
+{
+    return SCAN_ANY(_mm_cmpeq_epi8, _mm_or_si128, _mm_set1_epi8, v, '}', ']');
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_sexp_open(__m256i v)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8('('));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_sexp_close(__m256i v)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_json_open(__m256i v)
+{
+    return SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '{', '[');
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_json_close(__m256i v)
+{
+    return SCAN_ANY(_mm256_cmpeq_epi8, _mm256_or_si256, _mm256_set1_epi8, v, '}', ']');
+}
+
+/* the masks of a 64 byte block from 16 or 32 byte lanes */
+
+#define SCAN_SSE2_MASK(match, v) \
+    ((u64) (u32) _mm_movemask_epi8(match(v[0])) | \
+     (u64) (u32) _mm_movemask_epi8(match(v[1])) << 16 | \
+     (u64) (u32) _mm_movemask_epi8(match(v[2])) << 32 | \
+     (u64) (u32) _mm_movemask_epi8(match(v[3])) << 48)
+
+#define SCAN_AVX2_MASK(match, v) \
+    ((u64) (u32) _mm256_movemask_epi8(match(v[0])) | \
+     (u64) (u32) _mm256_movemask_epi8(match(v[1])) << 32)
+
+static void _scan_sse2_classify(char const * block, bool json, ScanMasks * masks)
+{
+    __m128i v[4];
+    for (int i = 0; i < 4; i++)
+    {
+        v[i] = _mm_loadu_si128((__m128i const *) block + i);
+    }
+    masks->quote = SCAN_SSE2_MASK(_sse2_quote, v);
+    masks->backslash = SCAN_SSE2_MASK(_sse2_backslash, v);
+    masks->whitespace = SCAN_SSE2_MASK(_sse2_whitespace, v);
+    if (json)
+    {
+        masks->structural = SCAN_SSE2_MASK(_sse2_json_structural, v);
+        masks->open = SCAN_SSE2_MASK(_sse2_json_open, v);
+        masks->close = SCAN_SSE2_MASK(_sse2_json_close, v);
+    }
+    else
+    {
+        masks->structural = SCAN_SSE2_MASK(_sse2_sexp_structural, v);
+        masks->open = SCAN_SSE2_MASK(_sse2_sexp_open, v);
+        masks->close = SCAN_SSE2_MASK(_sse2_sexp_close, v);
+    }
+}
+
+__attribute__((target("avx2")))
+static void _scan_avx2_classify(char const * block, bool json, ScanMasks * masks)
+{
+    __m256i v[2];
+    v[0] = _mm256_loadu_si256((__m256i const *) block);
+    v[1] = _mm256_loadu_si256((__m256i const *) block + 1);
+    masks->quote = SCAN_AVX2_MASK(_avx2_quote, v);
+    masks->backslash = SCAN_AVX2_MASK(_avx2_backslash, v);
+    masks->whitespace = SCAN_AVX2_MASK(_avx2_whitespace, v);
+    if (json)
+    {
+        masks->structural = SCAN_AVX2_MASK(_avx2_json_structural, v);
+        masks->open = SCAN_AVX2_MASK(_avx2_json_open, v);
+        masks->close = SCAN_AVX2_MASK(_avx2_json_close, v);
+    }
+    else
+    {
+        masks->structural = SCAN_AVX2_MASK(_avx2_sexp_structural, v);
+        masks->open = SCAN_AVX2_MASK(_avx2_sexp_open, v);
+        masks->close = SCAN_AVX2_MASK(_avx2_sexp_close, v);
+    }
+    _mm256_zeroupper();
+}
+
+#define SCAN_SSE2(name, match, scalar) \
+    static char const * name(char const * p, char const * end) \
+    { \
+        while (end - p >= 16) \
+        { \
+            unsigned mask = _mm_movemask_epi8(match(_mm_loadu_si128((__m128i const *) p))); \
+            if (mask) \
+            { \
+                return p + __builtin_ctz(mask); \
+            } \
+            p += 16; \
+        } \
+        return scalar(p, end); \
+    }
+
+/* the avx2 kernels clear the upper halves of the registers before they
+ * return, as the compiler does not do it for them at every level of
+ * optimization, and sse code after them would be slowed down otherwise */
+
+#define SCAN_AVX2(name, match, sse2) \
+    __attribute__((target("avx2"))) \
+    static char const * name(char const * p, char const * end) \
+    { \
+        while (end - p >= 32) \
+        { \
+            unsigned mask = _mm256_movemask_epi8(match(_mm256_loadu_si256((__m256i const *) p))); \
+            if (mask) \
+            { \
+                _mm256_zeroupper(); \
+                return p + __builtin_ctz(mask); \
+            } \
+            p += 32; \
+        } \
+        _mm256_zeroupper(); \
+        return sse2(p, end); \
+    }
+
+/* the utf-8 kernels pass ascii a block at a time and only check the
+ * sequences of the other bytes one by one */
+
+#define SCAN_SSE2_UTF8(name, match, scalar) \
+    static char const * name(char const * p, char const * end) \
+    { \
+        while (end - p >= 16) \
+        { \
+            __m128i const v = _mm_loadu_si128((__m128i const *) p); \
+            unsigned mask = _mm_movemask_epi8(match(v)) | _mm_movemask_epi8(v); \
+            if (!mask) \
+            { \
+                p += 16; \
+                continue; \
+            } \
+            p += __builtin_ctz(mask); \
+            size_t const size = (unsigned char) *p < 0x80 ? 0 : _scan_utf8_sequence(p, end); \
+            if (!size) \
+            { \
+                return p; \
+            } \
+            p += size; \
+        } \
+        return scalar(p, end); \
+    }
+
+SCAN_SSE2(_scan_sse2_whitespace, _sse2_not_whitespace, _scan_scalar_whitespace)
+SCAN_SSE2(_scan_sse2_string, _sse2_string, _scan_scalar_string)
+SCAN_SSE2(_scan_sse2_sexp_atom, _sse2_sexp_atom, _scan_scalar_sexp_atom)
+SCAN_SSE2(_scan_sse2_json_atom, _sse2_json_atom, _scan_scalar_json_atom)
+SCAN_SSE2(_scan_sse2_to_escape, _sse2_to_escape, _scan_scalar_to_escape)
+
+SCAN_AVX2(_scan_avx2_whitespace, _avx2_not_whitespace, _scan_sse2_whitespace)
+SCAN_AVX2(_scan_avx2_string, _avx2_string, _scan_sse2_string)
+SCAN_AVX2(_scan_avx2_sexp_atom, _avx2_sexp_atom, _scan_sse2_sexp_atom)
+SCAN_AVX2(_scan_avx2_json_atom, _avx2_json_atom, _scan_sse2_json_atom)
+SCAN_AVX2(_scan_avx2_to_escape, _avx2_to_escape, _scan_sse2_to_escape)
+
+SCAN_SSE2_UTF8(_scan_sse2_string_utf8, _sse2_string, _scan_scalar_string_utf8)
+
+/* with avx2, whole blocks of utf-8 are checked at once, after "validating
+ * utf-8 in less than one instruction per byte" by keiser and lemire. each
+ * byte is looked at together with the one before it: three tables give
+ * the errors that the high and low nibbles of the first byte and the high
+ * nibble of the second byte could be part of, and there is one where all
+ * three agree. the bytes that have to be the second or third continuation
+ * of a sequence are then found from the two and three bytes before. */
+
+enum
+{
+    SCAN_UTF8_TOO_SHORT = 1 << 0,      /* a lead not followed by a continuation */
+    SCAN_UTF8_TOO_LONG = 1 << 1,       /* a continuation after ascii */
+    SCAN_UTF8_OVERLONG_3 = 1 << 2,
+    SCAN_UTF8_TOO_LARGE = 1 << 3,      /* past U+10FFFF */
+    SCAN_UTF8_SURROGATE = 1 << 4,
+    SCAN_UTF8_OVERLONG_2 = 1 << 5,
+    SCAN_UTF8_TOO_LARGE_1000 = 1 << 6,
+    SCAN_UTF8_OVERLONG_4 = 1 << 6,
+    SCAN_UTF8_TWO_CONTS = 1 << 7,      /* a continuation after a continuation */
+    SCAN_UTF8_CARRY = SCAN_UTF8_TOO_SHORT | SCAN_UTF8_TOO_LONG | SCAN_UTF8_TWO_CONTS,
+};
+
+static unsigned char const g_scan_utf8_byte_1_high[16] =
+{
+    SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG,
+    SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG, SCAN_UTF8_TOO_LONG,
+    SCAN_UTF8_TWO_CONTS, SCAN_UTF8_TWO_CONTS, SCAN_UTF8_TWO_CONTS, SCAN_UTF8_TWO_CONTS,
+    SCAN_UTF8_TOO_SHORT | SCAN_UTF8_OVERLONG_2,
+    SCAN_UTF8_TOO_SHORT,
+    SCAN_UTF8_TOO_SHORT | SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_SURROGATE,
+    SCAN_UTF8_TOO_SHORT | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000 | SCAN_UTF8_OVERLONG_4,
+};
+
+static unsigned char const g_scan_utf8_byte_1_low[16] =
+{
+    SCAN_UTF8_CARRY | SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_OVERLONG_4,
+    SCAN_UTF8_CARRY | SCAN_UTF8_OVERLONG_2,
+    SCAN_UTF8_CARRY,
+    SCAN_UTF8_CARRY,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000 | SCAN_UTF8_SURROGATE,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+    SCAN_UTF8_CARRY | SCAN_UTF8_TOO_LARGE | SCAN_UTF8_TOO_LARGE_1000,
+};
+
+static unsigned char const g_scan_utf8_byte_2_high[16] =
+{
+    SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT,
+    SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT,
+    SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS |
+        SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_TOO_LARGE_1000 | SCAN_UTF8_OVERLONG_4,
+    SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS |
+        SCAN_UTF8_OVERLONG_3 | SCAN_UTF8_TOO_LARGE,
+    SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS |
+        SCAN_UTF8_SURROGATE | SCAN_UTF8_TOO_LARGE,
+    SCAN_UTF8_TOO_LONG | SCAN_UTF8_OVERLONG_2 | SCAN_UTF8_TWO_CONTS |
+        SCAN_UTF8_SURROGATE | SCAN_UTF8_TOO_LARGE,
+    SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT, SCAN_UTF8_TOO_SHORT,
+};
+
+/* the bytes n places before those of v, where prev holds the block before */
+#define SCAN_AVX2_PREV(v, prev, n) \
+    _mm256_alignr_epi8(v, _mm256_permute2x128_si256(prev, v, 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_lookup(unsigned char const * table, __m256i index)
+{
+    __m256i const lanes = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) table));
+    return _mm256_shuffle_epi8(lanes, _mm256_and_si256(index, _mm256_set1_epi8(0x0f)));
+}
+
+/* nonzero in the bytes of v where the utf-8 is wrong */
+__attribute__((target("avx2")))
+static inline __m256i _avx2_utf8_errors(__m256i v, __m256i prev)
+{
+    __m256i const prev1 = SCAN_AVX2_PREV(v, prev, 1);
+    __m256i const pairs = _mm256_and_si256(
+        _mm256_and_si256(_avx2_lookup(g_scan_utf8_byte_1_high, _mm256_srli_epi16(prev1, 4)),
+                         _avx2_lookup(g_scan_utf8_byte_1_low, prev1)),
+        _avx2_lookup(g_scan_utf8_byte_2_high, _mm256_srli_epi16(v, 4)));
+    __m256i const third = _mm256_subs_epu8(SCAN_AVX2_PREV(v, prev, 2), _mm256_set1_epi8((char) (0xe0 - 0x80)));
+    __m256i const fourth = _mm256_subs_epu8(SCAN_AVX2_PREV(v, prev, 3), _mm256_set1_epi8((char) (0xf0 - 0x80)));
+    __m256i const continuation = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char) 0x80));
+    return _mm256_xor_si256(continuation, pairs);
+}
+
+/* the start of the sequence that p may be in the middle of, given that the
+ * bytes from begin to p are valid */
+static char const * _scan_utf8_start(char const * begin, char const * p)
+{
+    for (int i = 1; i <= 3 && p - i >= begin; i++)
+    {
+        unsigned char const ch = p[-i];
+        if (ch < 0x80)
+        {
+            break;
+        }
+        if (ch >= 0xc0)
+        {
+            return p - i;
+        }
+    }
+    return p;
+}
+
+__attribute__((target("avx2")))
+static char const * _scan_avx2_string_utf8(char const * p, char const * end)
+{
+    char const * const begin = p;
+    /* a sequence that would go on past the end of a block is cut off if
+     * the next block does not go on with it */
+    __m256i const max_lead = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char) (0xf0 - 1), (char) (0xe0 - 1), (char) (0xc0 - 1));
+    __m256i prev = _mm256_setzero_si256();
+    __m256i cut = _mm256_setzero_si256();
+    while (end - p >= 32)
+    {
+        __m256i const v = _mm256_loadu_si256((__m256i const *) p);
+        u32 const stop = _mm256_movemask_epi8(_avx2_string(v));
+        u32 errors;
+        if (!_mm256_movemask_epi8(v))
+        {
+            errors = !_mm256_testz_si256(cut, cut);
+        }
+        else
+        {
+            __m256i const wrong = _avx2_utf8_errors(v, prev);
+            errors = ~(u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(wrong, _mm256_setzero_si256()));
+        }
+        if (stop)
+        {
+            /* what comes after the end of the string does not matter */
+            errors &= (u32) (((u64) 2 << __builtin_ctz(stop)) - 1);
+            if (!errors)
+            {
+                _mm256_zeroupper();
+                return p + __builtin_ctz(stop);
+            }
+        }
+        if (errors)
+        {
+            break;
+        }
+        prev = v;
+        cut = _mm256_subs_epu8(v, max_lead);
+        p += 32;
+    }
+    _mm256_zeroupper();
+    /* the rest, and any error, are found a sequence at a time */
+    return _scan_sse2_string_utf8(_scan_utf8_start(begin, p), end);
+}
+
+#endif /* SCAN_X86 */
+
+Scanner g_scan =
+{
+    _scan_scalar_whitespace,
+    _scan_scalar_string,
+    _scan_scalar_string_utf8,
+    _scan_scalar_to_escape,
+    _scan_scalar_sexp_atom,
+    _scan_scalar_json_atom,
+    _scan_scalar_classify,
+    "scalar",
+};
+
+void scan_init()
+{
+    _scan_init_classes();
+    _scan_init_escapes();
+
+    char const * want = getenv("SEXP_SCAN");
+#if SCAN_X86
+    __builtin_cpu_init();
+    bool const have_avx2 = __builtin_cpu_supports("avx2");
+    bool const have_sse2 = __builtin_cpu_supports("sse2");
+    if (have_avx2 && (!want || !strcmp(want, "avx2")))
+    {
+        Scanner const avx2 =
+        {
+            _scan_avx2_whitespace,
+            _scan_avx2_string,
+            _scan_avx2_string_utf8,
+            _scan_avx2_to_escape,
+            _scan_avx2_sexp_atom,
+            _scan_avx2_json_atom,
+            _scan_avx2_classify,
+            "avx2",
+        };
+        g_scan = avx2;
+    }
+    else if (have_sse2 && (!want || !strcmp(want, "avx2") || !strcmp(want, "sse2")))
+    {
+        Scanner const sse2 =
+        {
+            _scan_sse2_whitespace,
+            _scan_sse2_string,
+            _scan_sse2_string_utf8,
+            _scan_sse2_to_escape,
+            _scan_sse2_sexp_atom,
+            _scan_sse2_json_atom,
+            _scan_sse2_classify,
+            "sse2",
+        };
+        g_scan = sse2;
+    }
+#else
+    (void) want;
+#endif
+}
+
+/* the byte that each of the single letter escapes stands for */
+static char const g_scan_unescape[256] =
+{
+    ['"'] = '"',
+    ['\\'] = '\\',
+    ['/'] = '/',
+    ['b'] = '\b',
+    ['f'] = '\f',
+    ['n'] = '\n',
+    ['r'] = '\r',
+    ['t'] = '\t',
+};
+
+static bool _scan_hex4(char const * p, char const * end, u32 * pval)
+{
+    if (end - p < 4)
+    {
+        return false;
+    }
+    u32 val = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char const ch = p[i];
+        u32 digit;
+        if (ch >= '0' && ch <= '9')
+        {
+            digit = ch - '0';
+        }
+        else if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f')
+        {
+            digit = (ch | 0x20) - 'a' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        val = val << 4 | digit;
+    }
+    *pval = val;
+    return true;
+}
+
+char const * scan_escape(char const * p, char const * end, char * out, size_t * psize)
+{
+    ASSERT_DEBUG(p < end && *p == '\\');
+    if (end - p < 2)
+    {
+        return NULL;
+    }
+    unsigned char const ch = p[1];
+    if (ch != 'u')
+    {
+        if (!g_scan_unescape[ch])
+        {
+            return NULL;
+        }
+        out[0] = g_scan_unescape[ch];
+        *psize = 1;
+        return p + 2;
+    }
+
+    u32 code;
+    if (!_scan_hex4(p + 2, end, &code))
+    {
+        return NULL;
+    }
+    p += 6;
+    if (code >= 0xdc00 && code <= 0xdfff)
+    {
+        return NULL;
+    }
+    if (code >= 0xd800 && code <= 0xdbff)
+    {
+        u32 low;
+        if (end - p < 2 || p[0] != '\\' || p[1] != 'u' || !_scan_hex4(p + 2, end, &low) ||
+            low < 0xdc00 || low > 0xdfff)
+        {
+            return NULL;
+        }
+        p += 6;
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+    }
+
+    unsigned char * const u = (unsigned char *) out;
+    if (code < 0x80)
+    {
+        u[0] = code;
+        *psize = 1;
+    }
+    else if (code < 0x800)
+    {
+        u[0] = 0xc0 | code >> 6;
+        u[1] = 0x80 | (code & 0x3f);
+        *psize = 2;
+    }
+    else if (code < 0x10000)
+    {
+        u[0] = 0xe0 | code >> 12;
+        u[1] = 0x80 | (code >> 6 & 0x3f);
+        u[2] = 0x80 | (code & 0x3f);
+        *psize = 3;
+    }
+    else
+    {
+        u[0] = 0xf0 | code >> 18;
+        u[1] = 0x80 | (code >> 12 & 0x3f);
+        u[2] = 0x80 | (code >> 6 & 0x3f);
+        u[3] = 0x80 | (code & 0x3f);
+        *psize = 4;
+    }
+    return p;
+}
+
+#define SCAN_INDEX_WINDOW ((size_t) 1 << 16)
+
+void scan_index_open(ScanIndex * index, char const * data, size_t size, bool json)
+{
+    index->base = data;
+    index->next = data;
+    index->end = data + size;
+    index->offsets = (u32 *) malloc(SCAN_INDEX_WINDOW * sizeof(u32));
+    ASSERT(index->offsets);
+    index->num_offsets = 0;
+    index->pos = 0;
+    index->in_string = 0;
+    index->escaped = 0;
+    index->scalar = 0;
+    index->json = json;
+    index->stopped = false;
+}
+
+void scan_index_close(ScanIndex * index)
+{
+    free(index->offsets);
+    index->offsets = NULL;
+}
+
+void scan_index_rewind(ScanIndex * index, char const * p)
+{
+    if (p >= index->base && index->num_offsets)
+    {
+        /* the first offset at or after p is still in the window */
+        size_t lo = 0;
+        size_t hi = index->num_offsets;
+        while (lo < hi)
+        {
+            size_t const mid = lo + (hi - lo) / 2;
+            if (index->base + index->offsets[mid] < p)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        index->pos = lo;
+        return;
+    }
+    /* the window has moved on, so p is indexed again from the start */
+    index->base = index->next = p;
+    index->num_offsets = 0;
+    index->pos = 0;
+    index->in_string = 0;
+    index->escaped = 0;
+    index->scalar = 0;
+    index->stopped = false;
+}
+
+static u64 _scan_prefix_xor(u64 x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/* the bytes of a block that are escaped, given the backslashes in it; the
+ * carry says if the first byte of the next block is escaped. a byte is
+ * escaped if it follows an odd run of backslashes; the runs that start on
+ * an even bit are told apart from those that start on an odd bit by
+ * letting an addition carry through them. */
+static u64 _scan_escaped(u64 backslash, u64 * carry)
+{
+    u64 const even = 0x5555555555555555ull;
+    backslash &= ~*carry;
+    u64 const follows_escape = backslash << 1 | *carry;
+    u64 const odd_starts = backslash & ~even & ~follows_escape;
+    u64 even_starts;
+    *carry = __builtin_add_overflow(odd_starts, backslash, &even_starts);
+    return (even ^ (even_starts << 1)) & follows_escape;
+}
+
+/* the bytes of a block that are inside a string, given the quotes that are
+ * not escaped: the opening quote and the inside of a string are set, the
+ * closing quote is not. the carry is all ones if the next block starts
+ * inside a string. */
+static u64 _scan_in_string(u64 quote, u64 * carry)
+{
+    u64 const in_string = _scan_prefix_xor(quote) ^ *carry;
+    *carry = (u64) ((int64_t) in_string >> 63);
+    return in_string;
+}
+
+/* adds the tokens of the block at offset in the window, returns false if
+ * there is a backslash outside of a string */
+static bool _scan_index_block(ScanIndex * index, char const * block, u32 offset)
+{
+    ScanMasks m;
+    g_scan.classify(block, index->json, &m);
+
+    u64 const quote = m.quote & ~_scan_escaped(m.backslash, &index->escaped);
+    u64 const in_string = _scan_in_string(quote, &index->in_string);
+    if (m.backslash & ~in_string)
+    {
+        return false;
+    }
+
+    u64 const scalar = ~(m.structural | m.whitespace | m.quote) & ~in_string;
+    u64 tokens = (m.structural & ~in_string) | (quote & in_string) | (scalar & ~(scalar << 1 | index->scalar));
+    index->scalar = scalar >> 63;
+
+    u32 * out = index->offsets + index->num_offsets;
+    while (tokens)
+    {
+        *out++ = offset + __builtin_ctzll(tokens);
+        tokens &= tokens - 1;
+    }
+    index->num_offsets = out - index->offsets;
+    return true;
+}
+
+void _scan_index_fill(ScanIndex * index, char const * p)
+{
+    if (p > index->next)
+    {
+        /* nothing before p is asked for any more, and p is outside of any
+         * string and atom, so indexing can start afresh there */
+        index->next = p;
+        index->in_string = 0;
+        index->escaped = 0;
+        index->scalar = 0;
+    }
+    ASSERT(!index->stopped && index->next < index->end);
+    size_t const rest = index->end - index->next;
+    size_t const size = rest < SCAN_INDEX_WINDOW ? rest : SCAN_INDEX_WINDOW;
+    index->base = index->next;
+    index->num_offsets = 0;
+    index->pos = 0;
+    for (size_t offset = 0; offset < size; offset += 64)
+    {
+        char const * block = index->base + offset;
+        char padded[64];
+        if (size - offset < 64)
+        {
+            memset(padded, ' ', 64);
+            memcpy(padded, block, size - offset);
+            block = padded;
+        }
+        if (!_scan_index_block(index, block, offset))
+        {
+            index->stopped = true;
+            break;
+        }
+    }
+    index->next = index->base + size;
+}
+
+char const * scan_balanced(char const * p, char const * end, size_t depth, bool json)
+{
+    u64 escaped = 0;
+    u64 in_string = 0;
+    while (depth && p < end)
+    {
+        char const * block = p;
+        char padded[64];
+        if (end - p < 64)
+        {
+            memset(padded, ' ', 64);
+            memcpy(padded, p, end - p);
+            block = padded;
+        }
+        ScanMasks m;
+        g_scan.classify(block, json, &m);
+        u64 const quote = m.quote & ~_scan_escaped(m.backslash, &escaped);
+        u64 const inside = _scan_in_string(quote, &in_string);
+        if (m.backslash & ~inside)
+        {
+            return NULL;
+        }
+        u64 const open = m.open & ~inside;
+        u64 close = m.close & ~inside;
+        size_t const num_close = __builtin_popcountll(close);
+        if (num_close < depth)
+        {
+            depth += __builtin_popcountll(open);
+            depth -= num_close;
+            p += 64;
+            continue;
+        }
+        /* the depth may reach 0 in this block, so go through its brackets
+         * in order */
+        u64 brackets = open | close;
+        while (brackets)
+        {
+            u64 const bit = brackets & -brackets;
+            if (open & bit)
+            {
+                depth++;
+            }
+            else if (!--depth)
+            {
+                return p + __builtin_ctzll(bit) + 1;
+            }
+            brackets ^= bit;
+        }
+        p += 64;
+    }
+    return depth ? NULL : p;
+}
+
+#endif /* _SCAN_C_ */
+
+#endif
@@ -0,0 +1,626 @@
+
+#ifndef _SEXP_H_
+#define _SEXP_H_
+
+#include "lisp.h"
+#include "input.h"
+#include "output.h"
+#include "scan.h"
+
+/* reading and writing s-expressions
+ *
+ * the reader builds a value from an input. it keeps the lists it is in on
+ * a stack of its own instead of recursing, so nesting is only limited by
+ * memory; numbers are read as such, any other atom is interned, and an
+ * escape-free string in resident input is referenced in place. strings
+ * are written the same way in json, so the pieces that read them work on
+ * any input.
+ *
+ * the writer lays out lists by the well-known symbol at their head: pretty
+ * output puts every item of an array after its head on a line of its own,
+ * and every member of an object, and writes other lists on one line;
+ * compact output writes every value on one line. it writes objects and
+ * arrays as the pieces below do, so a value that json2sexp streams out
+ * looks the same as the tree of it. */
+
+typedef struct
+{
+    Expr head;
+    Expr tail;
+} SexpListFrame;
+
+typedef struct
+{
+    Input * in;
+    ScanIndex * index; /* jumps over whitespace in resident input, or NULL */
+    bool exact_numbers; /* see parse_number */
+    SexpListFrame * lists;
+    size_t num_lists;
+    size_t max_lists;
+} SexpReader;
+
+void sexp_reader_open(SexpReader * reader, Input * in, ScanIndex * index, bool exact_numbers);
+void sexp_reader_close(SexpReader * reader);
+
+void sexp_skip_whitespace(SexpReader * reader);
+
+/* reads the value at the input; the input must not be at its end */
+Expr sexp_read(SexpReader * reader);
+
+/* decodes the escape at the backslash at the input into the utf-8 bytes
+ * at out, which has room for SCAN_ESCAPE_UTF8_SIZE, and moves past it */
+void sexp_read_escape(Input * in, char * out, size_t * psize);
+
+/* reads the string that starts at the quote at the input */
+Expr sexp_read_string(Input * in);
+
+/* scans an atom and leaves it as the current token of the input */
+void sexp_read_token(Input * in);
+
+typedef struct
+{
+    Expr rest;
+    u64 position;
+    int layout;
+} SexpWriteFrame;
+
+typedef struct
+{
+    Output * out;
+    bool compact;
+    int indent;
+    int col;
+    SexpWriteFrame * frames;
+    size_t num_frames;
+    size_t max_frames;
+} SexpWriter;
+
+void sexp_writer_open(SexpWriter * writer, Output * out, bool compact);
+void sexp_writer_close(SexpWriter * writer);
+
+void sexp_write(SexpWriter * writer, Expr exp);
+
+/* ends a top-level value */
+void sexp_write_end(SexpWriter * writer);
+
+/* the pieces of values for writers that do not have a tree; an object or
+ * array starts with its first member or item, and its end tells whether it
+ * had none */
+void sexp_write_atom(SexpWriter * writer, Expr exp);
+void sexp_write_text(SexpWriter * writer, char const * text, size_t size);
+void sexp_write_string(SexpWriter * writer, char const * str, size_t size);
+void sexp_write_object_key(SexpWriter * writer, char const * name, size_t size, bool first);
+void sexp_write_object_end(SexpWriter * writer, bool empty);
+void sexp_write_array_item(SexpWriter * writer, bool first);
+void sexp_write_array_end(SexpWriter * writer, bool empty);
+
+#endif /* _SEXP_H_ */
+
+#ifdef SEXP_IMPLEMENTATION
+
+#ifndef _SEXP_C_
+#define _SEXP_C_
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+void sexp_reader_open(SexpReader * reader, Input * in, ScanIndex * index, bool exact_numbers)
+{
+    reader->in = in;
+    reader->index = index;
+    reader->exact_numbers = exact_numbers;
+    reader->lists = NULL;
+    reader->num_lists = 0;
+    reader->max_lists = 0;
+}
+
+void sexp_reader_close(SexpReader * reader)
+{
+    free(reader->lists);
+    reader->lists = NULL;
+    reader->num_lists = reader->max_lists = 0;
+}
+
+void sexp_skip_whitespace(SexpReader * reader)
+{
+    Input * in = reader->in;
+    if (reader->index && reader->index->offsets && in->cur < in->end && scan_is_whitespace(*in->cur))
+    {
+        char const * next = scan_index_next(reader->index, in->cur);
+        if (next)
+        {
+            in->cur = next;
+            return;
+        }
+    }
+    do
+    {
+        in->cur = scan_whitespace(in->cur, in->end);
+    }
+    while (in->cur == in->end && input_fill(in));
+}
+
+void sexp_read_escape(Input * in, char * out, size_t * psize)
+{
+    ASSERT(input_peek(in) == '\\');
+    /* the whole escape is decoded from the buffer at once */
+    bool more = true;
+    while (more && (size_t) (in->end - in->cur) < SCAN_ESCAPE_SIZE)
+    {
+        more = input_fill(in);
+    }
+    char const * p = scan_escape(in->cur, in->end, out, psize);
+    if (!p)
+    {
+        size_t const avail = in->end - in->cur;
+        FAIL("illegal escape sequence %.*s\n", (int) (avail < SCAN_ESCAPE_SIZE ? avail : SCAN_ESCAPE_SIZE), in->cur);
+    }
+    in->cur = p;
+}
+
+Expr sexp_read_string(Input * in)
+{
+    //fprintf(stderr, "%s()\n", __FUNCTION__);
+    ASSERT(input_peek(in) == '"');
+    input_advance(in);
+
+    /* an escape-free string in resident input is referenced in place */
+    char const * p = scan_string_utf8(in->cur, in->end);
+    if (input_resident(in) && p < in->end && *p == '"')
+    {
+        Expr ret = make_string_slice(in->cur, p - in->cur);
+        in->cur = p + 1;
+        return ret;
+    }
+
+    string_begin();
+    while (true)
+    {
+        string_append(in->cur, p - in->cur);
+        in->cur = p;
+
+        if (p < in->end && (unsigned char) *p >= 0x80)
+        {
+            /* the bytes at p are not valid utf-8, unless the end of the
+             * buffer cut them off */
+            if ((size_t) (in->end - p) >= SCAN_ESCAPE_UTF8_SIZE || !input_fill(in))
+            {
+                FAIL("invalid utf-8 in string\n");
+            }
+            p = scan_string_utf8(in->cur, in->end);
+            continue;
+        }
+
+        int ch = input_peek(in);
+        if (ch == -1)
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+            return nil;
+        }
+        else if (ch == '"')
+        {
+            break;
+        }
+        else if (ch == '\\')
+        {
+            char bytes[SCAN_ESCAPE_UTF8_SIZE];
+            size_t size;
+            sexp_read_escape(in, bytes, &size);
+            string_append(bytes, size);
+        }
+        p = scan_string_utf8(in->cur, in->end);
+    }
+
+    ASSERT(input_peek(in) == '"');
+    input_advance(in);
+
+    return string_end();
+}
+
+void sexp_read_token(Input * in)
+{
+    input_begin_token(in);
+    do
+    {
+        in->cur = scan_sexp_atom(in->cur, in->end);
+    }
+    while (in->cur == in->end && input_fill(in));
+
+    //fprintf(stderr, "TOKEN: %.*s\n", (int) input_token_size(in), in->token);
+}
+
+static Expr _sexp_read_atom(SexpReader * reader)
+{
+    Input * in = reader->in;
+    sexp_read_token(in);
+    Expr ret;
+    if (!parse_number(in->token, input_token_size(in), reader->exact_numbers, &ret))
+    {
+        ret = intern_n(in->token, input_token_size(in));
+    }
+    input_end_token(in);
+    return ret;
+}
+
+static void _sexp_push_list(SexpReader * reader)
+{
+    if (reader->num_lists == reader->max_lists)
+    {
+        reader->max_lists = reader->max_lists ? 2 * reader->max_lists : 64;
+        reader->lists = (SexpListFrame *) realloc(reader->lists, reader->max_lists * sizeof(SexpListFrame));
+        ASSERT(reader->lists);
+    }
+    reader->lists[reader->num_lists].head = nil;
+    reader->lists[reader->num_lists].tail = nil;
+    reader->num_lists++;
+}
+
+Expr sexp_read(SexpReader * reader)
+{
+    //fprintf(stderr, "%s()\n", __FUNCTION__);
+    Input * in = reader->in;
+    size_t const base = reader->num_lists;
+    while (true)
+    {
+        Expr exp = nil;
+        sexp_skip_whitespace(reader);
+        switch (input_peek(in))
+        {
+        case '(':
+            input_advance(in);
+            _sexp_push_list(reader);
+            continue;
+        case ')':
+            if (reader->num_lists == base)
+            {
+                FAIL("unexpected ')' in %s()\n", __FUNCTION__);
+            }
+            input_advance(in);
+            exp = reader->lists[--reader->num_lists].head;
+            break;
+        case '"':
+            exp = sexp_read_string(in);
+            break;
+        case -1:
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+            return nil;
+        default:
+            exp = _sexp_read_atom(reader);
+            break;
+        }
+
+        if (reader->num_lists == base)
+        {
+            return exp;
+        }
+        SexpListFrame * list = &reader->lists[reader->num_lists - 1];
+        Expr next = cons(exp, nil);
+        if (list->head)
+        {
+            rplacd(list->tail, next);
+        }
+        else
+        {
+            list->head = next;
+        }
+        list->tail = next;
+    }
+}
+
+void sexp_writer_open(SexpWriter * writer, Output * out, bool compact)
+{
+    writer->out = out;
+    writer->compact = compact;
+    writer->indent = 0;
+    writer->col = 0;
+    writer->frames = NULL;
+    writer->num_frames = 0;
+    writer->max_frames = 0;
+}
+
+void sexp_writer_close(SexpWriter * writer)
+{
+    free(writer->frames);
+    writer->frames = NULL;
+    writer->num_frames = writer->max_frames = 0;
+}
+
+/* pretty output goes through _sexp_emit for the indentation, compact
+ * output is appended to the buffer as is */
+
+/* emits a run of text, indenting every line that is not empty */
+static void _sexp_emit(SexpWriter * writer, char const * str, size_t size)
+{
+    char const * const end = str + size;
+    while (str < end)
+    {
+        char const * nl = (char const *) memchr(str, '\n', end - str);
+        char const * stop = nl ? nl : end;
+        if (stop > str)
+        {
+            if (writer->col == 0)
+            {
+                output_spaces(writer->out, writer->indent);
+            }
+            output_write(writer->out, str, stop - str);
+            writer->col += stop - str;
+        }
+        if (!nl)
+        {
+            break;
+        }
+        output_char(writer->out, '\n');
+        writer->col = 0;
+        str = nl + 1;
+    }
+}
+
+static void _sexp_emit_char(SexpWriter * writer, char ch)
+{
+    if (ch == '\n')
+    {
+        output_char(writer->out, '\n');
+        writer->col = 0;
+    }
+    else
+    {
+        if (writer->col == 0)
+        {
+            output_spaces(writer->out, writer->indent);
+        }
+        output_char(writer->out, ch);
+        writer->col++;
+    }
+}
+
+static void _sexp_char(SexpWriter * writer, char ch)
+{
+    if (writer->compact)
+    {
+        output_char(writer->out, ch);
+    }
+    else
+    {
+        _sexp_emit_char(writer, ch);
+    }
+}
+
+static void _sexp_str(SexpWriter * writer, char const * str)
+{
+    if (writer->compact)
+    {
+        output_write(writer->out, str, strlen(str));
+    }
+    else
+    {
+        _sexp_emit(writer, str, strlen(str));
+    }
+}
+
+void sexp_write_text(SexpWriter * writer, char const * text, size_t size)
+{
+    if (writer->compact)
+    {
+        output_write(writer->out, text, size);
+    }
+    else
+    {
+        _sexp_emit(writer, text, size);
+    }
+}
+
+void sexp_write_string(SexpWriter * writer, char const * p, size_t size)
+{
+    Output * out = writer->out;
+    if (!writer->compact)
+    {
+        if (writer->col == 0)
+        {
+            output_spaces(out, writer->indent);
+        }
+        writer->col += size + 2;
+    }
+    char const * const end = p + size;
+    output_char(out, '"');
+    while (p < end)
+    {
+        char const * run = scan_to_escape(p, end);
+        output_write(out, p, run - p);
+        if (run == end)
+        {
+            break;
+        }
+        ScanEscapeText const * esc = &g_scan_escape_text[(unsigned char) *run];
+        output_write(out, esc->text, esc->size);
+        p = run + 1;
+    }
+    output_char(out, '"');
+}
+
+void sexp_write_atom(SexpWriter * writer, Expr exp)
+{
+    switch (expr_type(exp))
+    {
+    case TYPE_NIL:
+        sexp_write_text(writer, "nil", 3);
+        break;
+    case TYPE_SYMBOL:
+        sexp_write_text(writer, symbol_name(exp), symbol_size(exp));
+        break;
+    case TYPE_KEYWORD:
+        _sexp_char(writer, ':');
+        sexp_write_text(writer, keyword_name(exp), keyword_size(exp));
+        break;
+    case TYPE_STRING:
+    case TYPE_SLICE:
+    case TYPE_SHORT_STRING:
+    {
+        char buffer[STRING_SHORT_SIZE];
+        sexp_write_string(writer, string_value(exp, buffer), string_size(exp));
+        break;
+    }
+    case TYPE_NUMBER:
+    case TYPE_BOXED_NUMBER:
+    {
+        char buffer[NUMBER_TEXT_SIZE];
+        size_t size;
+        char const * text = number_text(exp, buffer, &size);
+        sexp_write_text(writer, text, size);
+        break;
+    }
+    default:
+        FAIL("cannot write expression %016" PRIx64 "\n", exp);
+        break;
+    }
+}
+
+void sexp_write_object_key(SexpWriter * writer, char const * name, size_t size, bool first)
+{
+    if (writer->compact)
+    {
+        _sexp_str(writer, first ? "(object :" : " :");
+        output_write(writer->out, name, size);
+        output_char(writer->out, ' ');
+    }
+    else
+    {
+        if (first)
+        {
+            _sexp_str(writer, "(object");
+            writer->indent += 2;
+        }
+        _sexp_emit_char(writer, '\n');
+        _sexp_emit_char(writer, ':');
+        _sexp_emit(writer, name, size);
+        _sexp_emit_char(writer, ' ');
+    }
+}
+
+void sexp_write_object_end(SexpWriter * writer, bool empty)
+{
+    _sexp_str(writer, empty ? "(object)" : ")");
+    if (!empty && !writer->compact)
+    {
+        writer->indent -= 2;
+    }
+}
+
+void sexp_write_array_item(SexpWriter * writer, bool first)
+{
+    if (writer->compact)
+    {
+        _sexp_str(writer, first ? "(array " : " ");
+    }
+    else if (first)
+    {
+        _sexp_str(writer, "(array\n");
+        writer->indent += 2;
+    }
+    else
+    {
+        _sexp_emit_char(writer, '\n');
+    }
+}
+
+void sexp_write_array_end(SexpWriter * writer, bool empty)
+{
+    _sexp_str(writer, empty ? "(array)" : ")");
+    if (!empty && !writer->compact)
+    {
+        writer->indent -= 2;
+    }
+}
+
+void sexp_write_end(SexpWriter * writer)
+{
+    _sexp_char(writer, '\n');
+}
+
+/* writing walks the tree with an explicit stack of the lists it is in */
+
+enum
+{
+    SEXP_LAYOUT_FLAT,
+    SEXP_LAYOUT_OBJECT,
+    SEXP_LAYOUT_ARRAY,
+};
+
+/* how a list is laid out, by the well-known symbol at its head; dict and
+ * list are other names for object and array */
+static int const g_sexp_layouts[NUM_WELL_KNOWN_SYMBOLS + 1] =
+{
+    [SYMBOL_OBJECT] = SEXP_LAYOUT_OBJECT,
+    [SYMBOL_ARRAY] = SEXP_LAYOUT_ARRAY,
+    [SYMBOL_DICT] = SEXP_LAYOUT_OBJECT,
+    [SYMBOL_LIST] = SEXP_LAYOUT_ARRAY,
+};
+
+static void _sexp_push_frame(SexpWriter * writer, Expr list)
+{
+    if (writer->num_frames == writer->max_frames)
+    {
+        writer->max_frames = writer->max_frames ? 2 * writer->max_frames : 64;
+        writer->frames = (SexpWriteFrame *) realloc(writer->frames, writer->max_frames * sizeof(SexpWriteFrame));
+        ASSERT(writer->frames);
+    }
+    SexpWriteFrame * frame = &writer->frames[writer->num_frames++];
+    frame->rest = list;
+    frame->position = 0;
+    frame->layout = g_sexp_layouts[well_known_symbol(car(list))];
+}
+
+void sexp_write(SexpWriter * writer, Expr exp)
+{
+    size_t const base = writer->num_frames;
+    while (true)
+    {
+        if (is_pair(exp))
+        {
+            _sexp_char(writer, '(');
+            writer->indent += 2;
+            _sexp_push_frame(writer, exp);
+        }
+        else
+        {
+            sexp_write_atom(writer, exp);
+        }
+
+        /* move on to the next expression, closing what is finished */
+        while (true)
+        {
+            if (writer->num_frames == base)
+            {
+                return;
+            }
+            SexpWriteFrame * frame = &writer->frames[writer->num_frames - 1];
+            Expr rest = frame->rest;
+            if (!rest)
+            {
+                _sexp_char(writer, ')');
+                writer->indent -= 2;
+                writer->num_frames--;
+                continue;
+            }
+            if (!is_pair(rest))
+            {
+                FAIL("cannot write dotted list\n");
+            }
+
+            u64 const position = frame->position++;
+            if (position > 0)
+            {
+                bool const same_line = frame->layout == SEXP_LAYOUT_FLAT ||
+                    (frame->layout == SEXP_LAYOUT_OBJECT && position % 2 == 0);
+                _sexp_char(writer, writer->compact || same_line ? ' ' : '\n');
+            }
+            exp = car(rest);
+            frame->rest = cdr(rest);
+            break;
+        }
+    }
+}
+
+#endif /* _SEXP_C_ */
+
+#endif
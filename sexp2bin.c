@@ -0,0 +1,125 @@
+#define _DEFAULT_SOURCE
+
+#include "lisp.h"
+#include "binary.h"
+#include "input.h"
+#include "output.h"
+#include "scan.h"
+#include "sexp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* sexp2bin reads s-expressions and writes them as one binary stream */
+
+static Input g_in;
+static SexpReader g_reader;
+
+/* numbers keep the text they were read from when they would not be
+ * written back the same way, unless --normalize-numbers is given */
+static bool g_exact_numbers = true;
+
+static Output g_out;
+static BinaryWriter g_writer;
+
+static void flush_output()
+{
+    output_flush(&g_out);
+}
+
+static void sexp2bin()
+{
+    if (input_resident(&g_in))
+    {
+        string_set_source(g_in.map, g_in.map_size);
+    }
+
+    sexp_reader_open(&g_reader, &g_in, NULL, g_exact_numbers);
+
+    /* values are dropped once they are written, but the names stay, as
+     * the writer refers to them by their index for the whole stream */
+    HeapMark mark = heap_mark();
+    while (true)
+    {
+        sexp_skip_whitespace(&g_reader);
+        if (input_peek(&g_in) == -1)
+        {
+            break;
+        }
+        binary_write(&g_writer, sexp_read(&g_reader));
+        heap_keep_names(&mark);
+        heap_rewind(mark);
+    }
+    sexp_reader_close(&g_reader);
+}
+
+int main(int argc, char ** argv)
+{
+    scan_init();
+    output_open_fd(&g_out, 1);
+    atexit(flush_output);
+    binary_writer_open(&g_writer, &g_out);
+
+    char ** files = argv + 1;
+    int num_files = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--exact-numbers"))
+        {
+            g_exact_numbers = true;
+        }
+        else if (!strcmp(argv[i], "--normalize-numbers"))
+        {
+            g_exact_numbers = false;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            FAIL("unknown option %s\n", argv[i]);
+        }
+        else
+        {
+            files[num_files++] = argv[i];
+        }
+    }
+
+    if (num_files == 0)
+    {
+        input_open_fd(&g_in, 0);
+        sexp2bin();
+        input_close(&g_in);
+    }
+    for (int i = 0; i < num_files; i++)
+    {
+        if (!strcmp(files[i], "-"))
+        {
+            input_open_fd(&g_in, 0);
+        }
+        else
+        {
+            input_open_file(&g_in, files[i]);
+        }
+        sexp2bin();
+        input_close(&g_in);
+    }
+    binary_writer_close(&g_writer);
+    output_close(&g_out);
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "lisp.h"
+
+#define BINARY_IMPLEMENTATION
+#include "binary.h"
+
+#define INPUT_IMPLEMENTATION
+#include "input.h"
+
+#define OUTPUT_IMPLEMENTATION
+#include "output.h"
+
+#define SCAN_IMPLEMENTATION
+#include "scan.h"
+
+#define SEXP_IMPLEMENTATION
+#include "sexp.h"
@@ -1,45 +1,45 @@
 
+#define _DEFAULT_SOURCE
+
 #include "lisp.h"
+#include "input.h"
+#include "output.h"
+#include "parallel.h"
+#include "path.h"
+#include "scan.h"
+#include "sexp.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static bool is_whitespace(int ch)
-{
-    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
-}
+/* with -j the conversion runs on worker threads, so everything that one
+ * conversion reads or writes is private to its thread */
 
-static int peek_ch = -1;
+static THREAD_LOCAL Input g_in;
 
 static int peek()
 {
-    if (peek_ch == -1)
-    {
-        FILE * in = stdin;
-        peek_ch = getc(in);
-        ungetc(peek_ch, in);
-    }
-    //fprintf(stderr, "peek: '%c' (%d)\n", peek_ch, peek_ch);
-    return peek_ch;
+    //fprintf(stderr, "peek: '%c' (%d)\n", *g_in.cur, *g_in.cur);
+    return input_peek(&g_in);
 }
 
 static void advance()
 {
-    (void) getc(stdin);
-    //fprintf(stderr, "advance: '%c' (%d)\n", ch, ch);
-    peek_ch = -1;
+    //fprintf(stderr, "advance: '%c' (%d)\n", *g_in.cur, *g_in.cur);
+    input_advance(&g_in);
 }
 
-static bool at_whitespace()
-{
-    return is_whitespace(peek());
-}
+/* resident input has a structural index, which jumps over whitespace to
+ * the start of the next token */
+static THREAD_LOCAL ScanIndex g_index;
+
+static THREAD_LOCAL SexpReader g_reader;
 
 static void skip_whitespace()
 {
-    while (at_whitespace())
-    {
-        (void) advance();
-    }
+    sexp_skip_whitespace(&g_reader);
 }
 
 static bool at_eof()
@@ -60,419 +60,881 @@ char const * expr_type_name(Expr exp)
     case TYPE_PAIR:
         return "pair";
     case TYPE_STRING:
+    case TYPE_SLICE:
+    case TYPE_SHORT_STRING:
         return "string";
+    case TYPE_NUMBER:
+    case TYPE_BOXED_NUMBER:
+        return "number";
     default:
         return "#:<unknown>";
     }
 }
 
-static Expr read_expr();
+static bool token_is(char const * str)
+{
+    size_t const size = strlen(str);
+    return input_token_size(&g_in) == size && !memcmp(g_in.token, str, size);
+}
+
+/* numbers keep the text they were read from when they would not be
+ * written back the same way, unless --normalize-numbers is given */
+static bool g_exact_numbers = true;
+
+static THREAD_LOCAL Output g_out;
 
-static Expr read_list()
+static THREAD_LOCAL int g_indent = 0;
+static THREAD_LOCAL int g_col = 0;
+static THREAD_LOCAL int g_line = 0;
+
+static void flush_output()
 {
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    ASSERT(peek() == '(');
-    (void) advance();
+    output_flush(&g_out);
+}
 
-    Expr head = nil, tail = nil;
-    while (true)
+/* emits a run of text, indenting every line that is not empty */
+static void emit(char const * str, size_t size)
+{
+    char const * const end = str + size;
+    while (str < end)
     {
-        skip_whitespace();
-        int ch = peek();
-        if (ch == ')')
+        char const * nl = (char const *) memchr(str, '\n', end - str);
+        char const * stop = nl ? nl : end;
+        if (stop > str)
         {
-            (void) advance();
-            break;
+            if (g_col == 0)
+            {
+                output_spaces(&g_out, g_indent);
+            }
+            output_write(&g_out, str, stop - str);
+            g_col += stop - str;
         }
-        else if (ch == -1)
+        if (!nl)
         {
-            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
-            return nil;
+            break;
         }
-        else
+        output_char(&g_out, '\n');
+        g_col = 0;
+        g_line++;
+        str = nl + 1;
+    }
+}
+
+static void emit_char(char ch)
+{
+    if (ch == '\n')
+    {
+        output_char(&g_out, '\n');
+        g_col = 0;
+        g_line++;
+    }
+    else
+    {
+        if (g_col == 0)
         {
-            Expr exp = read_expr();
-            Expr next = cons(exp, nil);
-            if (head)
-            {
-                rplacd(tail, next);
-                tail = next;
-            }
-            else
-            {
-                head = tail = next;
-            }
+            output_spaces(&g_out, g_indent);
         }
+        output_char(&g_out, ch);
+        g_col++;
     }
-    return head;
 }
 
-static char * _store(size_t size, char * buffer, char ch, char * pout)
+static void emit_str(char const * str)
 {
-    //fprintf(stderr, "STORE: %c (%d)\n", ch, ch);
-    ASSERT((size_t) (pout - buffer) < size);
-    *pout++ = ch;
-    return pout;
+    ASSERT_DEBUG(str);
+    emit(str, strlen(str));
 }
 
-static Expr read_string()
+static void indent()
 {
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    ASSERT(peek() == '"');
-    (void) advance();
+    g_indent += 2;
+}
 
-    char buffer[4096];
-    char * pout = buffer;
-    //fprintf(stderr, "%c", peek());
-    while (true)
+static void dedent()
+{
+    g_indent -= 2;
+}
+
+/* the json writer; pretty output goes through emit for the indentation,
+ * compact output is appended to the buffer as is */
+
+static bool g_compact = false;
+
+static void write_str(char const * str)
+{
+    output_write(&g_out, str, strlen(str));
+}
+
+static void write_string(char const * p, size_t size)
+{
+    char const * const end = p + size;
+    output_char(&g_out, '"');
+    while (p < end)
     {
-        int ch = peek();
-        if (ch == -1)
-        {
-            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
-            return nil;
-        }
-        else if (ch == '"')
+        char const * run = scan_to_escape(p, end);
+        output_write(&g_out, p, run - p);
+        if (run == end)
         {
             break;
         }
-        else if (ch == '\\')
-        {
-            advance();
-            ch = peek();
-            switch (ch)
-            {
-            case '\\':
-                pout = _store(4096, buffer, '\\', pout);
-                advance();
-                break;
-            case '"':
-                pout = _store(4096, buffer, '"', pout);
-                advance();
-                break;
-            default:
-                FAIL("illegal escape sequence %c\n", ch);
-                return nil;
-            }
-        }
-        else
-        {
-            //fprintf(stderr, "%c", peek());
-            pout = _store(4096, buffer, ch, pout);
-            advance();
-        }
+        ScanEscapeText const * esc = &g_scan_escape_text[(unsigned char) *run];
+        output_write(&g_out, esc->text, esc->size);
+        p = run + 1;
     }
-
-    ASSERT(peek() == '"');
-    (void) advance();
-
-    pout = _store(4096, buffer, '\0', pout);
-    //fprintf(stderr, "%s\n", buffer);
-
-    return make_string(buffer);
+    output_char(&g_out, '"');
 }
 
-static bool is_symbol_char(int ch)
+static void json_null()
 {
-    if (ch == -1)
+    if (g_compact)
     {
-        return false;
+        write_str("null");
     }
-
-    if (is_whitespace(ch))
+    else
     {
-        return false;
+        emit_str("null");
     }
+}
 
-    if (ch == '(' || ch == ')')
+static void json_symbol(char const * name, size_t size)
+{
+    if (g_compact)
     {
-        return false;
+        output_write(&g_out, name, size);
     }
-
-    if (ch == '"')
+    else
     {
-        return false;
+        emit(name, size);
     }
-
-    return true;
 }
 
-static Expr read_symbol()
+static void json_number(Expr exp)
 {
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    char buffer[4096];
-    char * pout = buffer;
-    //fprintf(stderr, "%c", peek());
-    while (is_symbol_char(peek()))
-    {
-        int ch = peek();
-        advance();
-        //fprintf(stderr, "%c\n", ch);
-        pout = _store(4096, buffer, ch, pout);
-    }
-
-    pout = _store(4096, buffer, '\0', pout);
-
-    //fprintf(stderr, "BUFFER: %s\n", buffer);
-
-    return intern(buffer);
+    char buffer[NUMBER_TEXT_SIZE];
+    size_t size;
+    char const * text = number_text(exp, buffer, &size);
+    json_symbol(text, size);
 }
 
-static Expr read_expr()
+static void json_keyword(char const * name, size_t size)
 {
-    //fprintf(stderr, "%s()\n", __FUNCTION__);
-    Expr ret = nil;
-    skip_whitespace();
-    switch (peek())
+    if (g_compact)
     {
-    case '(':
-        ret = read_list();
-        break;
-    case '"':
-        ret = read_string();
-        break;
-    default:
-        ret = read_symbol();
-        break;
+        output_char(&g_out, ':');
+        output_write(&g_out, name, size);
+    }
+    else
+    {
+        emit_char(':');
+        emit(name, size);
     }
-    //fprintf(stderr, "READ => %016" PRIx64 " (%s)\n", ret, expr_type_name(ret));
-    return ret;
 }
 
-static bool maybe_read_expr(Expr * pexp)
+static void json_string(char const * str, size_t size)
 {
-    skip_whitespace();
-    if (at_eof())
+    if (!g_compact)
     {
-        return false;
+        if (g_col == 0)
+        {
+            output_spaces(&g_out, g_indent);
+        }
+        g_col += size + 2;
     }
-    *pexp = read_expr();
-    return true;
+    write_string(str, size);
 }
 
-static void render_expr(Expr exp);
-
-int g_indent = 0;
-int g_col = 0;
-int g_line = 0;
-
-static void emit_char(char ch)
+static void json_object_key(char const * name, size_t size, bool first)
 {
-    if (ch == '\n')
+    if (g_compact)
     {
-        putc('\n', stdout);
-        g_col = 0;
-        g_line++;
+        output_write(&g_out, first ? "{\"" : ",\"", 2);
+        output_write(&g_out, name, size);
+        output_write(&g_out, "\":", 2);
     }
     else
     {
-        if (g_col == 0)
+        if (first)
         {
-            for (int i = 0; i < g_indent; i++)
-            {
-                putc(' ', stdout);
-            }
+            emit_str("{");
+            indent();
         }
-        putc(ch, stdout);
-        g_col++;
+        else
+        {
+            emit_char(',');
+        }
+        emit_char('\n');
+        emit_str("\"");
+        emit(name, size);
+        emit_str("\": ");
     }
 }
 
-static void emit_str(char const * str)
+static void json_object_end(bool empty)
 {
-    ASSERT_DEBUG(str);
-    for (char const * p = str; *p; p++)
+    if (g_compact)
+    {
+        write_str(empty ? "{}" : "}");
+    }
+    else if (empty)
     {
-        emit_char(*p);
+        emit_str("{}");
+    }
+    else
+    {
+        dedent();
+        emit_char('\n');
+        emit_str("}");
     }
 }
 
-static void indent()
+static void json_array_item(bool first)
 {
-    g_indent += 2;
+    if (g_compact)
+    {
+        output_char(&g_out, first ? '[' : ',');
+    }
+    else if (first)
+    {
+        emit_str("[\n");
+        indent();
+    }
+    else
+    {
+        emit_str(", ");
+    }
 }
 
-static void dedent()
+static void json_array_end(bool empty)
 {
-    g_indent -= 2;
+    if (g_compact)
+    {
+        write_str(empty ? "[]" : "]");
+    }
+    else if (empty)
+    {
+        emit_str("[]");
+    }
+    else
+    {
+        dedent();
+        emit_str("\n]");
+    }
 }
 
-static void render_nil(Expr exp)
+static void json_end_value()
 {
-    if (is_nil(exp))
+    if (g_compact)
     {
-        printf("null");
+        output_char(&g_out, '\n');
     }
     else
     {
-        FAIL("cannot render expression %" PRIx64 "\n", exp);
+        emit_char('\n');
     }
 }
 
-static void render_symbol(Expr exp)
+/* rendering walks the tree with an explicit stack of the objects and
+ * arrays it is in, so it does not recurse either */
+
+enum
+{
+    RENDER_NONE,
+    RENDER_OBJECT,
+    RENDER_ARRAY,
+};
+
+/* what a list renders as, by the well-known symbol at its head; dict and
+ * list are other names for object and array */
+static int const g_render_heads[NUM_WELL_KNOWN_SYMBOLS + 1] =
+{
+    [SYMBOL_OBJECT] = RENDER_OBJECT,
+    [SYMBOL_ARRAY] = RENDER_ARRAY,
+    [SYMBOL_DICT] = RENDER_OBJECT,
+    [SYMBOL_LIST] = RENDER_ARRAY,
+};
+
+typedef struct
 {
-    ASSERT_DEBUG(is_symbol(exp));
-    emit_str(symbol_name(exp));
+    Expr rest;
+    int kind;
+    bool first;
+} RenderFrame;
+
+static THREAD_LOCAL RenderFrame * g_render_frames = NULL;
+static THREAD_LOCAL size_t g_num_render_frames = 0;
+static THREAD_LOCAL size_t g_max_render_frames = 0;
+
+static void push_render_frame(int kind, Expr rest)
+{
+    if (g_num_render_frames == g_max_render_frames)
+    {
+        g_max_render_frames = g_max_render_frames ? 2 * g_max_render_frames : 64;
+        g_render_frames = (RenderFrame *) realloc(g_render_frames, g_max_render_frames * sizeof(RenderFrame));
+        ASSERT(g_render_frames);
+    }
+    g_render_frames[g_num_render_frames].rest = rest;
+    g_render_frames[g_num_render_frames].kind = kind;
+    g_render_frames[g_num_render_frames].first = true;
+    g_num_render_frames++;
 }
 
-static void render_keyword(Expr exp)
+static void render_atom(Expr exp)
 {
-    ASSERT_DEBUG(is_keyword(exp));
-    emit_char(':');
-    emit_str(keyword_name(exp));
+    switch (expr_type(exp))
+    {
+    case TYPE_NIL:
+        json_null();
+        break;
+    case TYPE_SYMBOL:
+        json_symbol(symbol_name(exp), symbol_size(exp));
+        break;
+    case TYPE_NUMBER:
+    case TYPE_BOXED_NUMBER:
+        json_number(exp);
+        break;
+    case TYPE_KEYWORD:
+        json_keyword(keyword_name(exp), keyword_size(exp));
+        break;
+    case TYPE_STRING:
+    case TYPE_SLICE:
+    case TYPE_SHORT_STRING:
+    {
+        char buffer[STRING_SHORT_SIZE];
+        json_string(string_value(exp, buffer), string_size(exp));
+        break;
+    }
+    default:
+        FAIL("cannot render expression of type %s\n", expr_type_name(exp));
+        break;
+    }
 }
 
 static void render_pair(Expr exp)
 {
     ASSERT_DEBUG(is_pair(exp));
-    Expr head = car(exp);
-    if (head == intern("object"))
+    int const kind = g_render_heads[well_known_symbol(car(exp))];
+    if (kind == RENDER_NONE)
+    {
+        FAIL("cannot render pair %016" PRIx64 "\n", exp);
+    }
+    push_render_frame(kind, cdr(exp));
+}
+
+static void render_expr(Expr exp)
+{
+    size_t const base = g_num_render_frames;
+    while (true)
     {
-        Expr rest = cdr(exp);
-        if (rest)
+        if (is_pair(exp))
         {
-            emit_str("{");
-            indent();
-            bool first = true;
-            while (rest)
+            render_pair(exp);
+        }
+        else
+        {
+            render_atom(exp);
+        }
+
+        /* move on to the next expression, closing what is finished */
+        while (true)
+        {
+            if (g_num_render_frames == base)
+            {
+                return;
+            }
+            RenderFrame * frame = &g_render_frames[g_num_render_frames - 1];
+            Expr rest = frame->rest;
+            bool const first = frame->first;
+            if (!rest)
             {
-                if (first)
+                if (frame->kind == RENDER_OBJECT)
                 {
-                    first = false;
+                    json_object_end(first);
                 }
                 else
                 {
-                    emit_char(',');
+                    json_array_end(first);
                 }
-                emit_char('\n');
+                g_num_render_frames--;
+                continue;
+            }
 
+            frame->first = false;
+            if (frame->kind == RENDER_OBJECT)
+            {
                 Expr key = car(rest);
-                Expr val = cadr(rest);
-                if (is_keyword(key))
+                if (!is_keyword(key))
                 {
-                    emit_str("\"");
-                    emit_str(keyword_name(key));
-                    emit_str("\": ");
+                    FAIL("cannot render object key of type %s\n", expr_type_name(key));
                 }
-                else
+                json_object_key(keyword_name(key), keyword_size(key), first);
+                exp = cadr(rest);
+                frame->rest = cddr(rest);
+            }
+            else
+            {
+                if (!is_pair(rest))
                 {
-                    FAIL("cannot render object key of type %s\n", expr_type_name(key));
+                    FAIL("cannot map dotted list to json\n");
                 }
-                render_expr(val);
-                rest = cddr(rest);
+                json_array_item(first);
+                exp = car(rest);
+                frame->rest = cdr(rest);
             }
-            dedent();
-            emit_char('\n');
-            emit_str("}");
-        }
-        else
-        {
-            emit_str("{}");
+            break;
         }
     }
-    else if (head == intern("array"))
+}
+
+/* streaming turns tokens into writer calls as they are read, without
+ * building a tree; the render stack holds the objects and arrays that are
+ * open, so memory only grows with the nesting depth */
+
+static bool g_stream = false;
+
+static void stream_atom()
+{
+    if (peek() == '"')
+    {
+        HeapMark const mark = heap_mark();
+        Expr str = sexp_read_string(&g_in);
+        char buffer[STRING_SHORT_SIZE];
+        json_string(string_value(str, buffer), string_size(str));
+        heap_rewind(mark);
+        return;
+    }
+
+    sexp_read_token(&g_in);
+    char const * text = g_in.token;
+    size_t const size = input_token_size(&g_in);
+    HeapMark const mark = heap_mark();
+    Expr num;
+    if (token_is("nil"))
+    {
+        json_null();
+    }
+    else if (!g_exact_numbers && parse_number(text, size, false, &num))
     {
-        Expr rest = cdr(exp);
-        if (rest)
+        /* written as the tree would; unless --normalize-numbers is
+         * given, that is the token as it is */
+        json_number(num);
+        heap_rewind(mark);
+    }
+    else if (size > 1 && text[0] == ':')
+    {
+        json_keyword(text + 1, size - 1);
+    }
+    else
+    {
+        json_symbol(text, size);
+    }
+    input_end_token(&g_in);
+}
+
+/* the head of a list decides what it maps to, so it is read as soon as
+ * the list opens */
+static void stream_list()
+{
+    ASSERT(peek() == '(');
+    advance();
+    skip_whitespace();
+    int ch = peek();
+    if (ch == ')')
+    {
+        advance();
+        json_null();
+        return;
+    }
+    else if (ch == '(' || ch == '"' || ch == -1)
+    {
+        FAIL("cannot render list without a symbol at its head\n");
+    }
+
+    sexp_read_token(&g_in);
+    int const kind = g_render_heads[well_known_symbol(intern_n(g_in.token, input_token_size(&g_in)))];
+    if (kind == RENDER_NONE)
+    {
+        FAIL("cannot render list with head %.*s\n", (int) input_token_size(&g_in), g_in.token);
+    }
+    push_render_frame(kind, nil);
+    input_end_token(&g_in);
+}
+
+static void stream_expr()
+{
+    size_t const base = g_num_render_frames;
+    bool want_value = true;
+    while (true)
+    {
+        if (want_value)
         {
-            emit_str("[\n");
-            indent();
-            for (Expr iter = rest; iter; iter = cdr(iter))
+            skip_whitespace();
+            int ch = peek();
+            if (ch == '(')
             {
-                if (is_pair(iter))
-                {
-                    render_expr(car(iter));
-                }
-                else
-                {
-                    FAIL("cannot map dotted list to json\n");
-                    break;
-                }
-                if (cdr(iter))
-                {
-                    emit_str(", ");
-                }
+                stream_list();
+            }
+            else if (ch == ')' || ch == -1)
+            {
+                FAIL("unexpected %s in %s()\n", ch == -1 ? "end of stream" : "')'", __FUNCTION__);
+            }
+            else
+            {
+                stream_atom();
+            }
+            want_value = false;
+        }
+
+        if (g_num_render_frames == base)
+        {
+            return;
+        }
+
+        /* move on to the next item of the innermost object or array */
+        RenderFrame * frame = &g_render_frames[g_num_render_frames - 1];
+        bool const first = frame->first;
+        skip_whitespace();
+        int ch = peek();
+        if (ch == ')')
+        {
+            advance();
+            if (frame->kind == RENDER_OBJECT)
+            {
+                json_object_end(first);
+            }
+            else
+            {
+                json_array_end(first);
+            }
+            g_num_render_frames--;
+            continue;
+        }
+        else if (ch == -1)
+        {
+            FAIL("unexpected end of stream in %s()\n", __FUNCTION__);
+        }
+
+        frame->first = false;
+        if (frame->kind == RENDER_OBJECT)
+        {
+            if (ch == '(' || ch == '"')
+            {
+                FAIL("cannot render object key of type %s\n", ch == '(' ? "pair" : "string");
+            }
+            sexp_read_token(&g_in);
+            if (input_token_size(&g_in) < 2 || g_in.token[0] != ':')
+            {
+                FAIL("cannot render object key %.*s\n", (int) input_token_size(&g_in), g_in.token);
+            }
+            json_object_key(g_in.token + 1, input_token_size(&g_in) - 1, first);
+            input_end_token(&g_in);
+
+            /* a key without a value maps to null, as (cadr rest) would */
+            skip_whitespace();
+            if (peek() == ')')
+            {
+                json_null();
+                continue;
             }
-            dedent();
-            emit_str("\n]");
         }
         else
         {
-            emit_str("[]");
+            json_array_item(first);
         }
+        want_value = true;
     }
-    else
+}
+
+/* --select renders only the value at a path in each top-level value. the
+ * path is followed while reading, and everything off the path is skipped
+ * by scanning for the brackets that balance it, without building any of
+ * it; values where the path leads nowhere render nothing */
+
+static Path g_select;
+
+/* follows --select and --where through the input */
+static THREAD_LOCAL PathReader g_path;
+
+static void select_expr()
+{
+    size_t depth;
+    int const found = path_follow(&g_path, &g_select, &depth);
+    if (found != PATH_NONE)
     {
-        FAIL("cannot render pair %016" PRIx64 "\n", exp);
+        if (found == PATH_NIL)
+        {
+            json_null();
+        }
+        else if (g_stream)
+        {
+            stream_expr();
+        }
+        else
+        {
+            render_expr(sexp_read(&g_reader));
+        }
+        json_end_value();
     }
+    path_skip_to_close(&g_path, depth);
 }
 
-static void render_string(Expr exp)
+/* --where drops the top-level values that fail a test. the path of the
+ * test is followed as for --select, and once the test fails the rest of
+ * the value is skipped in the same way; a value that passes is read again
+ * from its start, which a mark keeps in the input */
+
+static PathTest g_where;
+
+/* moves to the next top-level value that passes --where, returns false at
+ * the end of the stream */
+static bool next_value()
 {
-    ASSERT_DEBUG(is_string(exp));
-    char const * str = string_value(exp);
-    emit_char('"');
-    for (char const * p = str; *p; p++)
+    while (true)
     {
-        char const ch = *p;
-        switch (ch)
+        skip_whitespace();
+        if (at_eof())
         {
-        case '\\':
-            emit_char('\\');
-            emit_char('\\');
-            break;
-        case '"':
-            emit_char('\\');
-            emit_char('"');
-            break;
-        default:
-            emit_char(ch);
-            break;
+            return false;
+        }
+        if (!g_where.path.num_steps || path_test_passes(&g_path, &g_where))
+        {
+            return true;
         }
     }
-    emit_char('"');
 }
 
-static void render_expr(Expr exp)
+static void convert_values()
 {
-    switch (expr_type(exp))
+    /* nothing outlives the value it was read for */
+    HeapMark const mark = heap_mark();
+    while (next_value())
     {
-    case TYPE_NIL:
-        render_nil(exp);
-        break;
-    case TYPE_SYMBOL:
-        render_symbol(exp);
-        break;
-    case TYPE_KEYWORD:
-        render_keyword(exp);
-        break;
-    case TYPE_PAIR:
-        render_pair(exp);
-        break;
-    case TYPE_STRING:
-        render_string(exp);
-        break;
-    default:
-        FAIL("cannot render expression of type %s\n", expr_type_name(exp));
-        break;
+        if (g_select.num_steps)
+        {
+            select_expr();
+        }
+        else if (g_stream)
+        {
+            stream_expr();
+            json_end_value();
+        }
+        else
+        {
+            render_expr(sexp_read(&g_reader));
+            json_end_value();
+        }
+        heap_rewind(mark);
     }
 }
 
 static void sexp2json()
 {
-    Expr exp;
-    while (maybe_read_expr(&exp))
+    if (input_resident(&g_in))
     {
-        render_expr(exp);
-        emit_char('\n');
+        string_set_source(g_in.map, g_in.map_size);
+        scan_index_open(&g_index, g_in.cur, g_in.end - g_in.cur, false);
+    }
+    sexp_reader_open(&g_reader, &g_in, &g_index, g_exact_numbers);
+    path_reader_open(&g_path, &g_in, &g_index, false);
+    convert_values();
+    sexp_reader_close(&g_reader);
+    if (g_index.offsets)
+    {
+        scan_index_close(&g_index);
     }
 }
 
-int main(int argc, char ** argv)
+/* -j cuts the input into chunks of whole values for the worker threads.
+ * the structural index gives the tokens, and a chunk can end before any
+ * token outside of every list that starts a value rather than closing
+ * or separating one */
+
+static int g_num_threads = 1;
+static size_t g_chunk_size = 0;
+
+static size_t split_values(char const * data, size_t size, size_t target)
 {
+    ScanIndex index;
+    scan_index_open(&index, data, size, false);
+    char const * const end = data + size;
+    char const * p = data;
+    size_t depth = 0;
+    size_t ret = 0;
+    /* an unmatched close is left for the reader to report; if the index
+     * stops, the rest of the input is not split */
+    while ((p = scan_index_next(&index, p)) && p < end)
+    {
+        if (depth == 0 && (size_t) (p - data) >= target && *p != ')')
+        {
+            ret = p - data;
+            break;
+        }
+        if (*p == '(')
+        {
+            depth++;
+        }
+        else if (*p == ')' && depth)
+        {
+            depth--;
+        }
+        p++;
+    }
+    scan_index_close(&index);
+    return ret;
+}
+
+static void convert_chunk(char const * data, size_t size, Output * out)
+{
+    input_open_memory(&g_in, data, size);
+    g_out = *out;
     sexp2json();
+    *out = g_out;
+    input_close(&g_in);
+}
+
+static void convert_input()
+{
+    if (g_num_threads > 1)
+    {
+        parallel_run(&g_in, &g_out, split_values);
+    }
+    else
+    {
+        sexp2json();
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    scan_init();
+    output_open_fd(&g_out, 1);
+    atexit(flush_output);
+
+    /* options and files can come in any order; what is left in files after
+     * the options are taken out is read in order */
+    char ** files = argv + 1;
+    int num_files = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--compact"))
+        {
+            g_compact = true;
+        }
+        else if (!strcmp(argv[i], "--exact-numbers"))
+        {
+            g_exact_numbers = true;
+        }
+        else if (!strcmp(argv[i], "--normalize-numbers"))
+        {
+            g_exact_numbers = false;
+        }
+        else if (!strcmp(argv[i], "--stream"))
+        {
+            g_stream = true;
+        }
+        else if (!strcmp(argv[i], "--select"))
+        {
+            if (++i == argc)
+            {
+                FAIL("--select needs a path\n");
+            }
+            path_parse(&g_select, argv[i]);
+        }
+        else if (!strcmp(argv[i], "--where"))
+        {
+            if (++i == argc)
+            {
+                FAIL("--where needs a test\n");
+            }
+            path_parse_test(&g_where, argv[i]);
+        }
+        else if (!strcmp(argv[i], "-j"))
+        {
+            if (++i == argc)
+            {
+                FAIL("-j needs a number of threads\n");
+            }
+            char * stop;
+            long num = strtol(argv[i], &stop, 10);
+            if (*stop || stop == argv[i] || num < 0 || num > 1024)
+            {
+                FAIL("bad number of threads %s\n", argv[i]);
+            }
+            /* -j 0 uses one thread per cpu */
+            g_num_threads = num ? num : sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        else if (!strcmp(argv[i], "--chunk-size"))
+        {
+            if (++i == argc)
+            {
+                FAIL("--chunk-size needs a number of bytes\n");
+            }
+            char * stop;
+            long long num = strtoll(argv[i], &stop, 10);
+            if (*stop || stop == argv[i] || num < 1)
+            {
+                FAIL("bad chunk size %s\n", argv[i]);
+            }
+            g_chunk_size = num;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            FAIL("unknown option %s\n", argv[i]);
+        }
+        else
+        {
+            files[num_files++] = argv[i];
+        }
+    }
+
+    if (g_num_threads > 1)
+    {
+        parallel_start(g_num_threads, g_chunk_size, convert_chunk);
+    }
+
+    if (num_files == 0)
+    {
+        input_open_fd(&g_in, 0);
+        convert_input();
+        input_close(&g_in);
+    }
+    for (int i = 0; i < num_files; i++)
+    {
+        if (!strcmp(files[i], "-"))
+        {
+            input_open_fd(&g_in, 0);
+        }
+        else
+        {
+            input_open_file(&g_in, files[i]);
+        }
+        convert_input();
+        input_close(&g_in);
+    }
+    if (g_num_threads > 1)
+    {
+        parallel_stop();
+    }
+    output_close(&g_out);
     return 0;
 }
 
 #define LISP_IMPLEMENTATION
 #include "lisp.h"
+
+#define INPUT_IMPLEMENTATION
+#include "input.h"
+
+#define OUTPUT_IMPLEMENTATION
+#include "output.h"
+
+#define PARALLEL_IMPLEMENTATION
+#include "parallel.h"
+
+#define PATH_IMPLEMENTATION
+#include "path.h"
+
+#define SCAN_IMPLEMENTATION
+#include "scan.h"
+
+#define SEXP_IMPLEMENTATION
+#include "sexp.h"
@@ -0,0 +1,185 @@
+
+#include "../../lisp.h"
+
+#include <inttypes.h>
+
+/* usage: objects
+ *
+ * checks object_find, object_get and object_duplicate_key against a walk
+ * of the members, for objects small enough to be walked and ones that are
+ * indexed, and writes what was looked up to stdout. a check that fails
+ * stops it with an assertion. */
+
+#define MAX_KEYS 128
+
+static Expr g_keys[MAX_KEYS];
+static Expr g_other_keys[MAX_KEYS];
+
+/* (object :k0 v0 :k1 v1 ...) with the values from base on */
+static Expr make_object(Expr const * keys, int num_members, int64_t base)
+{
+    Expr members = nil;
+    for (int i = num_members - 1; i >= 0; i--)
+    {
+        members = cons(keys[i], cons(make_integer(base + i), members));
+    }
+    return cons(sym_object, members);
+}
+
+static Expr walk_find(Expr obj, Expr key)
+{
+    for (Expr member = cdr(obj); member; member = cddr(member))
+    {
+        if (car(member) == key)
+        {
+            return member;
+        }
+    }
+    return nil;
+}
+
+/* the first key to occur a second time as the members are walked */
+static Expr walk_duplicate(Expr obj)
+{
+    for (Expr member = cdr(obj); member; member = cddr(member))
+    {
+        for (Expr before = cdr(obj); before != member; before = cddr(before))
+        {
+            if (car(before) == car(member))
+            {
+                return car(member);
+            }
+        }
+    }
+    return nil;
+}
+
+static void check_lookup(Expr obj, Expr key)
+{
+    Expr const member = walk_find(obj, key);
+    ASSERT(object_find(obj, key) == member);
+    ASSERT(object_get(obj, key) == cadr(member));
+}
+
+static char const * key_name(Expr key)
+{
+    return key ? keyword_name(key) : "nil";
+}
+
+static void print_value(char const * what, Expr val)
+{
+    if (is_number(val))
+    {
+        printf("%s %" PRId64 "\n", what, number_integer(val));
+    }
+    else
+    {
+        printf("%s %s\n", what, val ? "?" : "nil");
+    }
+}
+
+static void test_sizes()
+{
+    Expr const missing = make_keyword("missing");
+    for (int num_members = 0; num_members <= 100; num_members++)
+    {
+        HeapMark const mark = heap_mark();
+        Expr obj = make_object(g_keys, num_members, 0);
+        /* twice, so the second round finds the index the first one built */
+        for (int round = 0; round < 2; round++)
+        {
+            for (int i = 0; i < num_members; i++)
+            {
+                check_lookup(obj, g_keys[i]);
+            }
+            check_lookup(obj, missing);
+            check_lookup(obj, g_other_keys[0]);
+        }
+        ASSERT(object_duplicate_key(obj) == nil);
+        heap_rewind(mark);
+    }
+    printf("sizes 0 to 100: every key found, missing keys nil, no duplicates\n");
+}
+
+static void test_duplicates(int num_members)
+{
+    HeapMark const mark = heap_mark();
+    Expr keys[MAX_KEYS];
+    for (int i = 0; i < num_members; i++)
+    {
+        keys[i] = g_keys[i];
+    }
+    /* the last two members repeat :k2 and :k1, in that order */
+    keys[num_members - 2] = g_keys[2];
+    keys[num_members - 1] = g_keys[1];
+    Expr obj = make_object(keys, num_members, 0);
+    for (int i = 0; i < num_members; i++)
+    {
+        check_lookup(obj, keys[i]);
+    }
+    ASSERT(object_duplicate_key(obj) == walk_duplicate(obj));
+    printf("duplicates in %d members:\n", num_members);
+    print_value("  k2 =>", object_get(obj, g_keys[2]));
+    print_value("  k1 =>", object_get(obj, g_keys[1]));
+    printf("  duplicate key %s\n", key_name(object_duplicate_key(obj)));
+    heap_rewind(mark);
+}
+
+/* an indexed object that is dropped and built again in the same pairs must
+ * not be looked up through the index of the one before it */
+static void test_rewind(int num_members)
+{
+    HeapMark const mark = heap_mark();
+    Expr const first = make_object(g_keys, num_members, 0);
+    ASSERT(number_integer(object_get(first, g_keys[5])) == 5);
+    heap_rewind(mark);
+
+    Expr const second = make_object(g_other_keys, num_members, 100);
+    ASSERT(second == first);
+    for (int i = 0; i < num_members; i++)
+    {
+        check_lookup(second, g_keys[i]);
+        check_lookup(second, g_other_keys[i]);
+    }
+    printf("rebuilt %d members after a rewind:\n", num_members);
+    print_value("  k5 =>", object_get(second, g_keys[5]));
+    print_value("  j5 =>", object_get(second, g_other_keys[5]));
+    heap_rewind(mark);
+}
+
+/* values can be changed in place once an object is indexed */
+static void test_set_value(int num_members)
+{
+    HeapMark const mark = heap_mark();
+    Expr const obj = make_object(g_keys, num_members, 0);
+    printf("set a value in %d members:\n", num_members);
+    print_value("  k3 =>", object_get(obj, g_keys[3]));
+    rplaca(cdr(object_find(obj, g_keys[3])), make_integer(42));
+    check_lookup(obj, g_keys[3]);
+    print_value("  k3 =>", object_get(obj, g_keys[3]));
+    heap_rewind(mark);
+}
+
+int main()
+{
+    for (int i = 0; i < MAX_KEYS; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "k%d", i);
+        g_keys[i] = make_keyword(name);
+        snprintf(name, sizeof(name), "j%d", i);
+        g_other_keys[i] = make_keyword(name);
+    }
+
+    test_sizes();
+    test_duplicates(6);
+    test_duplicates(24);
+    test_rewind(6);
+    test_rewind(24);
+    test_set_value(6);
+    test_set_value(24);
+    return 0;
+}
+
+#define LISP_IMPLEMENTATION
+#include "../../lisp.h"